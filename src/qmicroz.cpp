@@ -27,253 +27,393 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QStringBuilder>
+#include <QByteArrayMatcher>
+#include <QCryptographicHash>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTemporaryFile>
+#include <QThread>
+#include <QtEndian>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(Q_OS_LINUX)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+#if defined(RECORD_TRACE_EVENTS)
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#endif
 
 const QString QMicroz::s_zip_ext = QStringLiteral(u".zip");
+static constexpr QChar s_sep = u'/';
 
-QMicroz::QMicroz(QObject *parent)
-    : QObject(parent) {}
+// Counters of the calling thread, see QMicroz::stats()
+static thread_local QMicroz::Stats t_stats;
 
-QMicroz::QMicroz(const char* zipPath, QObject *parent)
-    : QObject(parent)
+// Time counted by the StatsTimers of the calling thread, to tell the nested ones
+static thread_local qint64 t_timed_ns = 0;
+
+/* Adds the wall time of its scope to the <field> of the thread's counters.
+ * The time of the nested timers (e.g. the file I/O or CRC within a decompression)
+ * is already counted in their own fields, so it is subtracted.
+ */
+class StatsTimer
 {
-    setZipFile(QString(zipPath));
-}
+public:
+    explicit StatsTimer(qint64 QMicroz::Stats::*field)
+        : m_field(field), m_timed_start(t_timed_ns)
+    {
+        m_timer.start();
+    }
 
-QMicroz::QMicroz(const QString &zipPath, QObject *parent)
-    : QObject(parent)
+    ~StatsTimer()
+    {
+        const qint64 elapsed = m_timer.nsecsElapsed();
+        t_stats.*m_field += elapsed - (t_timed_ns - m_timed_start);
+        t_timed_ns = m_timed_start + elapsed;
+    }
+
+private:
+    qint64 QMicroz::Stats::*m_field;
+    qint64 m_timed_start;
+    QElapsedTimer m_timer;
+}; // class StatsTimer
+
+/* Original miniz stdio callbacks.
+ * All file-based archives share the same ones, so they are stored once.
+ */
+static std::atomic<mz_file_read_func> s_file_read { nullptr };
+static std::atomic<mz_file_write_func> s_file_write { nullptr };
+
+static size_t timedFileRead(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n)
 {
-    setZipFile(zipPath);
+    StatsTimer timer(&QMicroz::Stats::fileIoNs);
+    return s_file_read.load(std::memory_order_relaxed)(pOpaque, file_ofs, pBuf, n);
 }
 
-QMicroz::QMicroz(const QString &zipPath, Mode mode, QObject *parent)
-    : QObject(parent)
+static size_t timedFileWrite(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
 {
-    setZipFile(zipPath, mode);
+    StatsTimer timer(&QMicroz::Stats::fileIoNs);
+    return s_file_write.load(std::memory_order_relaxed)(pOpaque, file_ofs, pBuf, n);
 }
 
-QMicroz::QMicroz(const QByteArray &bufferedZip, QObject *parent)
-    : QObject(parent)
+// Wraps the stdio callbacks of the file-based <pZip> to count the archive I/O time
+static void hookFileIo(mz_zip_archive *pZip)
 {
-    setZipBuffer(bufferedZip);
+    if (pZip->m_zip_type != MZ_ZIP_TYPE_FILE)
+        return;
+
+    if (pZip->m_pRead && pZip->m_pRead != timedFileRead) {
+        s_file_read.store(pZip->m_pRead, std::memory_order_relaxed);
+        pZip->m_pRead = timedFileRead;
+    }
+
+    if (pZip->m_pWrite && pZip->m_pWrite != timedFileWrite) {
+        s_file_write.store(pZip->m_pWrite, std::memory_order_relaxed);
+        pZip->m_pWrite = timedFileWrite;
+    }
 }
 
-QMicroz::~QMicroz()
+#if defined(RECORD_TRACE_EVENTS)
+// A completed span of an archive operation
+struct TraceEvent {
+    const char *name;
+    QString arg;      // entry name or path
+    qint64 startNs;   // since the trace start
+    qint64 durNs;
+    int tid;
+};
+
+static std::atomic<bool> s_trace_enabled { false };
+static QElapsedTimer s_trace_clock;
+static QMutex s_trace_mutex;
+static std::vector<TraceEvent> s_trace_events;
+
+// Short sequential id of the calling thread
+static int traceThreadId()
 {
-    closeArchive();
+    static std::atomic<int> s_last_id { 0 };
+    static thread_local const int t_id = ++s_last_id;
+    return t_id;
 }
 
-bool QMicroz::isModeReading() const
+// Records the span of its scope while the tracing is started
+class TraceSpan
 {
-    return m_archive && (PZIP->m_zip_mode == mz_zip_mode::MZ_ZIP_MODE_READING);
-}
+public:
+    explicit TraceSpan(const char *name, const QString &arg = QString())
+        : m_active(s_trace_enabled.load(std::memory_order_acquire))
+    {
+        if (m_active) {
+            m_name = name;
+            m_arg = arg;
+            m_start = s_trace_clock.nsecsElapsed();
+        }
+    }
 
-bool QMicroz::isModeWriting() const
+    ~TraceSpan()
+    {
+        if (!m_active)
+            return;
+
+        const qint64 end = s_trace_clock.nsecsElapsed();
+        QMutexLocker locker(&s_trace_mutex);
+        s_trace_events.push_back({ m_name, m_arg, m_start, end - m_start, traceThreadId() });
+    }
+
+private:
+    bool m_active;
+    const char *m_name = nullptr;
+    QString m_arg;
+    qint64 m_start = 0;
+}; // class TraceSpan
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+#else
+// Compiles to nothing; the arguments are not evaluated
+#define TRACE_SPAN(...)
+#endif
+
+// Source file reader for <mz_zip_writer_add_read_buf_callback>
+static size_t readFromFile(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n)
 {
-    return m_archive && (PZIP->m_zip_mode == mz_zip_mode::MZ_ZIP_MODE_WRITING);
+    StatsTimer timer(&QMicroz::Stats::fileIoNs);
+    QFile *file = static_cast<QFile *>(pOpaque);
+
+    if (file->pos() != (qint64)file_ofs && !file->seek(file_ofs))
+        return 0;
+
+    const qint64 read = file->read(static_cast<char *>(pBuf), n);
+    return read > 0 ? read : 0;
 }
 
-void QMicroz::setVerbose(bool enable)
+// Counts a processed entry in the thread's counters
+static void countEntry(qint64 bytes_in, qint64 bytes_out)
 {
-    m_verbose = enable;
+    t_stats.bytesIn += bytes_in;
+    t_stats.bytesOut += bytes_out;
+    ++t_stats.entries;
 }
 
-bool QMicroz::setZipFile(const QString &zipPath, Mode mode)
-{
-    // close the currently opened one if any
-    closeArchive();
+// Counters of the worker threads, added to the calling thread's ones when they are done
+struct WorkersStats {
+    // Called by each worker thread at its end
+    void collect()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats += t_stats;
+    }
 
-    Mode zamode = ModeAuto; // 0
+    // Called by the calling thread after joining the workers
+    void merge() { t_stats += stats; }
 
-    switch (mode) {
-    case ModeAuto:
-        if (!QFileInfo::exists(zipPath))
-            zamode = ModeWrite;
-        else if (isZipFile(zipPath))
-            zamode = ModeRead;
-        break;
-    case ModeRead:
-        if (isZipFile(zipPath))
-            zamode = ModeRead;
-        break;
-    case ModeWrite:
-        zamode = ModeWrite;
-        break;
-    default:
-        break;
-    }
+    QMicroz::Stats stats;
+    std::mutex mutex;
+};
 
-    if (zamode == 0) {
-        qWarning() << WARNING_WRONGPATH << zipPath;
-        return false;
-    }
+// Output file writer for <mz_zip_reader_extract_to_callback>; the data comes sequentially
+static size_t writeToFile(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
+{
+    Q_UNUSED(file_ofs)
+    StatsTimer timer(&QMicroz::Stats::fileIoNs);
+    QFile *file = static_cast<QFile *>(pOpaque);
 
-    // create and open a zip archive
-    mz_zip_archive *pZip = new mz_zip_archive();
-    QByteArray zipPathBytes = zipPath.toUtf8();
-    const char* zapath = zipPathBytes.constData();
+    return file->write(static_cast<const char *>(pBuf), n) == (qint64)n ? n : 0;
+}
 
-    // Here the <zamode> can be either ModeRead or ModeWrite
-    bool success = (zamode == ModeWrite) ? mz_zip_writer_init_file(pZip, zapath, 0)
-                                         : mz_zip_reader_init_file(pZip, zapath, 0);
+// Digests of the extracted data, fed on the fly: see Manifest
+struct FileDigester {
+    explicit FileDigester(const DigestList &algorithms)
+    {
+        for (int algorithm : algorithms) {
+            hashes.emplace_back(new QCryptographicHash(QCryptographicHash::Algorithm(algorithm)));
+        }
+    }
 
-    if (!success) {
-        qWarning() << "QMicroz: Failed to open zip file:" << zipPath;
-        delete pZip;
-        return false;
+    // Starts the next file
+    void reset()
+    {
+        for (const std::unique_ptr<QCryptographicHash> &hash : hashes) {
+            hash->reset();
+        }
     }
 
-    m_archive = pZip;
-    m_zip_path = zipPath;
+    void addData(const char *data, qint64 size)
+    {
+        StatsTimer timer(&QMicroz::Stats::digestNs);
 
-    if (isModeReading()) {
-        setOutputFolder(); // zip file's parent folder
-    }
+        // by parts, the sizes of the Qt5 arrays are int
+        while (size > 0) {
+            const int part = qMin<qint64>(size, 1 << 30);
+            const QByteArray view = QByteArray::fromRawData(data, part);
 
-    return true;
-}
+            for (const std::unique_ptr<QCryptographicHash> &hash : hashes) {
+                hash->addData(view);
+            }
 
-bool QMicroz::setZipBuffer(const QByteArray &bufferedZip)
-{
-    if (!isArchive(bufferedZip)) {
-        qWarning() << "QMicroz: The byte array is not zipped";
-        return false;
+            data += part;
+            size -= part;
+        }
     }
 
-    // open zip archive
-    mz_zip_archive *pZip = new mz_zip_archive();
+    QVector<QByteArray> results() const
+    {
+        QVector<QByteArray> res;
+        res.reserve(hashes.size());
 
-    if (mz_zip_reader_init_mem(pZip, bufferedZip.constData(), bufferedZip.size(), 0)) {
-        // close the currently opened one if any
-        closeArchive();
+        for (const std::unique_ptr<QCryptographicHash> &hash : hashes) {
+            res.append(hash->result());
+        }
 
-        // set the new one
-        m_archive = pZip;
-        return true;
+        return res;
     }
 
-    qWarning() << "QMicroz: Failed to open buffered zip";
-    delete pZip;
-    return false;
-}
+    std::vector<std::unique_ptr<QCryptographicHash>> hashes;
+    QFile *file = nullptr; // output of the <writeAndDigest>
+};
 
-void QMicroz::setOutputFolder(const QString &outputFolder)
+// Output file writer for <mz_zip_reader_extract_to_callback> which also feeds the written data to the digests
+static size_t writeAndDigest(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
 {
-    if (outputFolder.isEmpty() && !m_zip_path.isEmpty()) {
-        // set zip file's parent folder
-        m_output_folder = QFileInfo(m_zip_path).absolutePath();
-        return;
-    }
+    FileDigester *digester = static_cast<FileDigester *>(pOpaque);
 
-    m_output_folder = outputFolder;
+    if (writeToFile(digester->file, file_ofs, pBuf, n) != n)
+        return 0;
+
+    digester->addData(static_cast<const char *>(pBuf), n);
+    return n;
 }
 
-const QString& QMicroz::outputFolder() const
+// Reader of the in memory archive opened for Writing (QByteArray)
+static size_t readFromBuffer(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n)
 {
-    if (m_output_folder.isEmpty())
-        qWarning() << "QMicroz: No output folder.";
+    const QByteArray *buffer = static_cast<const QByteArray *>(pOpaque);
 
-    return m_output_folder;
+    if (file_ofs >= (mz_uint64)buffer->size())
+        return 0;
+
+    n = qMin<mz_uint64>(n, buffer->size() - file_ofs);
+    std::memcpy(pBuf, buffer->constData() + file_ofs, n);
+    return n;
 }
 
-void QMicroz::closeArchive()
+// Writer of the in memory archive: grows the QByteArray geometrically, so the appends are amortized
+static size_t writeToBuffer(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
 {
-    if (!m_archive)
-        return;
-
-    mz_zip_archive *pZip = PZIP;
+    using size_type = decltype(QByteArray().size());
+    QByteArray *buffer = static_cast<QByteArray *>(pOpaque);
+    const mz_uint64 end = file_ofs + n;
+
+    if (end > (mz_uint64)std::numeric_limits<size_type>::max())
+        return 0;
+
+    if (end > (mz_uint64)buffer->size()) {
+        if (end > (mz_uint64)buffer->capacity())
+            buffer->reserve(qMin<mz_uint64>(qMax<mz_uint64>(end, 2 * (mz_uint64)buffer->capacity()),
+                                            std::numeric_limits<size_type>::max()));
+        buffer->resize(end);
+    }
 
-    if (isModeWriting())
-        mz_zip_writer_finalize_archive(pZip);
+    // detaches the shared data on the first write
+    std::memcpy(buffer->data() + file_ofs, pBuf, n);
+    return n;
+}
 
-    if (!mz_zip_end(pZip))
-        qWarning() << "QMicroz: Failed to close archive.";
+// Largest buffer sized by the archive data: the QByteArray limit of Qt 5, also a sane cap for the untrusted sizes
+static constexpr qint64 s_max_buf_size = std::numeric_limits<int>::max() - 64;
 
-    delete pZip;
-    m_archive = nullptr;
-    m_zip_entries.clear();
-    m_zip_path.clear();
-    m_output_folder.clear();
+// Whether the <size> declared by the archive can be held in a QByteArray
+static inline bool fitsBuffer(qint64 size)
+{
+    return size >= 0 && size <= s_max_buf_size;
 }
 
-bool QMicroz::addEntry(const QString &entryName, std::function<bool()> addFunc)
+/* Replaces the <to> file with the <from> one: atomically by the POSIX rename.
+ * Elsewhere the original is moved aside and restored if the <from> can't take its place.
+ */
+static bool replaceFile(const QString &from, const QString &to)
 {
-    if (entryName.isEmpty())
-        return false;
-
-    if (m_verbose)
-        std::cout << "Adding: " << entryName.toStdString();
+#if defined(Q_OS_UNIX)
+    return std::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#else
+    const QString backup = from + QStringLiteral(u".bak");
 
-    if (m_zip_entries.contains(entryName)) {
-        if (m_verbose)
-            std::cout << CH_SPACE << RESULT_EXISTS << std::endl;
+    if (!QFile::rename(to, backup))
         return false;
-    }
 
-    if (!addFunc()) {
-        if (m_verbose)
-            std::cout << CH_SPACE << RESULT_FAILED << std::endl;
+    if (!QFile::rename(from, to)) {
+        QFile::rename(backup, to);
         return false;
     }
 
-    if (m_verbose)
-        std::cout << CH_SPACE << RESULT_OK << std::endl;
-
-    m_zip_entries[entryName] = m_zip_entries.size();
+    QFile::remove(backup);
     return true;
+#endif
 }
 
-qint64 QMicroz::sizeCompressed() const
+// Checks whether the <name> is a folder entry name (ends with '/')
+static inline bool isFolderName(const QString &name)
 {
-    return PZIP ? PZIP->m_archive_size : 0;
+    return name.endsWith(s_sep);
 }
 
-qint64 QMicroz::sizeUncompressed() const
+// Checks whether the <name> is a file entry name
+static inline bool isFileName(const QString &name)
 {
-    qint64 total_size = 0;
-
-    for (int it = 0; it < count(); ++it) {
-        total_size += sizeUncompressed(it);
-    }
-
-    return total_size;
+    return !name.isEmpty() && !name.endsWith(s_sep);
 }
 
-const QString& QMicroz::zipFilePath() const
+// Appends '/' if not any
+static inline QString toFolderName(const QString &name)
 {
-    return m_zip_path;
+    return name.endsWith(s_sep) ? name : name + s_sep;
 }
 
-const ZipContents& QMicroz::contents()
+// Concatenates path strings, ensuring the separator is not duplicated
+static QString joinPath(const QString &abs_path, const QString &rel_path)
 {
-    auto updateContents = [this] {
-        m_zip_entries.clear();
+    auto isSep = [] (QChar ch) { return ch == '/' || ch == '\\'; };
 
-        // iterating...
-        for (int it = 0; it < count(); ++it) {
-            const QString filename = name(it);
-            if (!filename.isEmpty())
-                m_zip_entries[filename] = it;
-        }
-    }; // lambda
+    const bool s1Ends = !abs_path.isEmpty() && isSep(abs_path.back());
+    const bool s2Starts = !rel_path.isEmpty() && isSep(rel_path.front());
 
-    // not cached yet
-    if (m_zip_entries.isEmpty() && isModeReading())
-        updateContents();
+    if (s1Ends && s2Starts) {
+        QStringView chopped = QStringView(abs_path).left(abs_path.size() - 1);
+        return chopped % rel_path;
+    }
 
-    return m_zip_entries;
-}
+    if (s1Ends || s2Starts)
+        return abs_path + rel_path;
 
-int QMicroz::count() const
-{
-    return mz_zip_reader_get_num_files(PZIP);
+    return abs_path % s_sep % rel_path;
 }
 
-int QMicroz::findIndex(const QString &fileName)
+// Returns the index of the <fileName> entry in the <entries>, -1 if not found
+static int findInContents(const ZipContents &entries, const QString &fileName)
 {
-    const ZipContents &entries = contents();
-
     // full path matching
     if (entries.contains(fileName))
         return entries.value(fileName);
@@ -293,507 +433,4223 @@ int QMicroz::findIndex(const QString &fileName)
     return -1;
 }
 
-bool QMicroz::isFolder(int index) const
+// Returns the offset of the entry data in the archive (after the local header), -1 if failed
+static qint64 localDataOffset(mz_zip_archive *pZip, int index)
 {
-    return isFolderName(name(index));
-}
+    mz_zip_archive_file_stat file_stat;
+    if (!mz_zip_reader_file_stat(pZip, index, &file_stat))
+        return -1;
+
+    // signature, ..., file name length (26), extra field length (28)
+    uchar header[30];
+    if (pZip->m_pRead(pZip->m_pIO_opaque, file_stat.m_local_header_ofs, header, sizeof(header)) != sizeof(header)
+        || qFromLittleEndian<quint32>(header) != 0x04034b50)
+    {
+        return -1;
+    }
 
-bool QMicroz::isFile(int index) const
-{
-    return isFileName(name(index));
+    return file_stat.m_local_header_ofs + sizeof(header)
+           + qFromLittleEndian<quint16>(header + 26) + qFromLittleEndian<quint16>(header + 28);
 }
 
-QString QMicroz::name(int index) const
+// Extra field id of the data alignment padding, as written by the Android zipalign
+static constexpr quint16 s_align_extra_id = 0xd935;
+
+/* Returns the local extra field which aligns the data of the next entry (with a <nameSize> bytes name)
+ * to the <alignment>: the id, the size, the alignment (0 for 64 KiB) and the zero padding.
+ * A padding too large for the extra field is written as a gap before the local header.
+ */
+static QByteArray alignmentExtra(mz_zip_archive *pZip, int nameSize, int alignment)
 {
-    mz_zip_archive_file_stat file_stat;
-    if (mz_zip_reader_file_stat(PZIP, index, &file_stat))
-        return file_stat.m_filename;
+    static const int header_size = 30; // local file header
+    static const int extra_min = 6;    // id, size, alignment
 
-    return QString();
-}
+    // the zip64 local headers get an extra field of their own
+    if (alignment <= 1 || pZip->m_archive_size >= MZ_UINT32_MAX)
+        return QByteArray();
 
-qint64 QMicroz::sizeCompressed(int index) const
-{
-    mz_zip_archive_file_stat file_stat;
-    if (mz_zip_reader_file_stat(PZIP, index, &file_stat))
-        return file_stat.m_comp_size;
+    const mz_uint64 data_ofs = pZip->m_archive_size + header_size + nameSize + extra_min;
+    int padding = (alignment - data_ofs % alignment) % alignment;
 
-    return 0;
+    if (padding > 0xffff - extra_min) {
+        const QByteArray gap(padding, '\0');
+        if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, gap.constData(), gap.size()) != (size_t)gap.size())
+            return QByteArray();
+
+        pZip->m_archive_size += padding;
+        padding = 0;
+    }
+
+    QByteArray extra(extra_min + padding, '\0');
+    uchar *p = reinterpret_cast<uchar *>(extra.data());
+    qToLittleEndian<quint16>(s_align_extra_id, p);
+    qToLittleEndian<quint16>(quint16(extra.size() - 4), p + 2);
+    qToLittleEndian<quint16>(quint16(alignment), p + 4);
+    return extra;
 }
 
-qint64 QMicroz::sizeUncompressed(int index) const
+// Returns the alignment stored in the <alignmentExtra> field of the entry with <index>, 0 if none
+static int localAlignment(mz_zip_archive *pZip, int index)
 {
     mz_zip_archive_file_stat file_stat;
-    if (mz_zip_reader_file_stat(PZIP, index, &file_stat))
-        return file_stat.m_uncomp_size;
+    if (!mz_zip_reader_file_stat(pZip, index, &file_stat))
+        return 0;
+
+    uchar header[30];
+    if (pZip->m_pRead(pZip->m_pIO_opaque, file_stat.m_local_header_ofs, header, sizeof(header)) != sizeof(header)
+        || qFromLittleEndian<quint32>(header) != 0x04034b50)
+    {
+        return 0;
+    }
+
+    const quint16 name_size = qFromLittleEndian<quint16>(header + 26);
+    QByteArray extra(qFromLittleEndian<quint16>(header + 28), Qt::Uninitialized);
+
+    if (pZip->m_pRead(pZip->m_pIO_opaque, file_stat.m_local_header_ofs + sizeof(header) + name_size,
+                      extra.data(), extra.size()) != (size_t)extra.size())
+    {
+        return 0;
+    }
+
+    const uchar *p = reinterpret_cast<const uchar *>(extra.constData());
+
+    // the fields: id, size, data
+    for (int i = 0; i + 4 <= extra.size(); i += 4 + qFromLittleEndian<quint16>(p + i + 2)) {
+        if (qFromLittleEndian<quint16>(p + i) == s_align_extra_id && i + 6 <= extra.size()) {
+            const int alignment = qFromLittleEndian<quint16>(p + i + 4);
+
+            // a power of two, as the ZipWriter::setAlignment accepts
+            if (alignment == 0)
+                return 0x10000;
+            return (alignment & (alignment - 1)) ? 0 : alignment;
+        }
+    }
 
     return 0;
 }
 
-QDateTime QMicroz::lastModified(int index) const
+#if defined(Q_OS_LINUX)
+/* Copies <size> bytes at the <offset> of the <fd_in> to the <fd_out> without passing the data through the user space:
+ * copy_file_range (file to file, reflink on supporting filesystems), or sendfile (to sockets, across filesystems).
+ * Returns the number of bytes copied.
+ */
+static qint64 copyInKernel(int fd_in, qint64 offset, int fd_out, qint64 size)
 {
-    qint64 sec = 0;
+    loff_t off_in = offset;
+    qint64 copied = 0;
+    bool copy_range = true;
 
-    mz_zip_archive_file_stat file_stat;
-    if (mz_zip_reader_file_stat(PZIP, index, &file_stat))
-        sec = file_stat.m_time;
+    while (copied < size) {
+        ssize_t n = -1;
 
-    return sec > 0 ? QDateTime::fromSecsSinceEpoch(sec) : QDateTime();
-}
+        if (copy_range) {
+            n = ::copy_file_range(fd_in, &off_in, fd_out, nullptr, size - copied, 0);
 
-bool QMicroz::addToZip(const QString &sourcePath)
-{
-    return addToZip(sourcePath, QFileInfo(sourcePath).fileName());
-}
+            // not supported for these fds, e.g. a socket or older kernels across filesystems
+            if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+                copy_range = false;
+                continue;
+            }
+        } else {
+            off_t off = off_in;
+            n = ::sendfile(fd_out, fd_in, &off, size - copied);
+            off_in = off;
+        }
 
-bool QMicroz::addToZip(const QString &sourcePath, const QString &entryName)
-{
-    if (!isModeWriting()) {
-        qWarning() << WARNING_WRONGMODE;
-        return false;
-    }
+        if (n < 0 && errno == EINTR)
+            continue;
 
-    if (entryName.isEmpty() || !QFileInfo::exists(sourcePath)) {
-        return false;
+        if (n <= 0)
+            break;
+
+        copied += n;
     }
 
-    /* <source> is a path to the file on the file system.
-     * <entry> its name or path inside the archive.
-     */
-    auto addFile = [this](const QString &source, const QString &entry) {
-        mz_zip_archive *pZip = PZIP;
+    return copied;
+}
+#endif
 
-        std::function<bool()> func = [pZip, &source, &entry]() {
-            QByteArray entryBytes = entry.toUtf8();
-            QByteArray sourceBytes = source.toUtf8();
+// Files from this size are inflated straight into the memory mapped output file
+static constexpr qint64 s_map_min_size = 1 << 20;
 
-            return mz_zip_writer_add_file(pZip,                    // zip archive
-                                          entryBytes.constData(),  // entry name/path inside the zip
-                                          sourceBytes.constData(), // filesystem path
-                                          NULL, 0,
-                                          COMPLEVEL(QFileInfo(source).size()));
-        };
+// Stored files from this size are copied in the kernel
+static constexpr qint64 s_copy_min_size = 1 << 20;
 
-        return this->addEntry(entry, func);
-    }; // lambda addFile -> bool
+// The largest inflated size of a deflated byte: a 258 bytes match coded by 2 bits
+static constexpr qint64 s_max_deflate_ratio = 1032;
 
-    /* <entry> is a name or path of the folder inside the archive.
-     * <modified> its last modified date; invalid QDateTime() to set current.
-     */
-    auto addFolder = [this](const QString &entry, const QDateTime &modified) {
-        BufFile bf(toFolderName(entry), modified);
-        return this->addToZip(bf);
-    }; // lambda addFolder -> bool
+/* Inflates the file with <index> into the <file> mapped into memory: the output is preallocated
+ * to the <size>, and the flat buffer decoder writes straight into the mapping,
+ * without the copy from the dictionary and the stdio buffering.
+ * The <digester> if set takes the data from the mapping before it is unmapped.
+ * <mapped> is set if the mapping is done, so a failure is of the decoding, not worth a retry.
+ */
+static bool inflateToMapped(mz_zip_archive *pZip, int index, QFile &file, qint64 size, FileDigester *digester,
+                            bool &mapped)
+{
+    mapped = false;
+    uchar *data = nullptr;
 
-    QFileInfo fi_source(sourcePath);
+    {
+        StatsTimer timer(&QMicroz::Stats::fileIoNs);
 
-    if (fi_source.isFile()) {
-        return addFile(sourcePath, entryName);
-    } else if (fi_source.isDir()) {
-        // adding the folder entry itself
+#if defined(Q_OS_LINUX)
+        // reserves the blocks, so the writes to the mapping can't fail for lack of space
+        if (::posix_fallocate(file.handle(), 0, size) != 0)
+            return false;
+#endif
+
+        if (file.resize(size))
+            data = file.map(0, size);
+    }
+
+    if (!data)
+        return false;
+
+    mapped = true;
+    QByteArray read_buf(MZ_ZIP_MAX_IO_BUF_SIZE, Qt::Uninitialized);
+    const bool res = mz_zip_reader_extract_to_mem_no_alloc(pZip, index, data, size, 0,
+                                                           read_buf.data(), read_buf.size());
+    if (res && digester)
+        digester->addData(reinterpret_cast<const char *>(data), size);
+
+    file.unmap(data);
+    return res;
+}
+
+// Closes and frees the miniz archive
+static void endArchive(mz_zip_archive *pZip)
+{
+    if (!pZip)
+        return;
+
+    if (!mz_zip_end(pZip))
+        qWarning() << "QMicroz: Failed to close archive.";
+
+    delete pZip;
+}
+
+
+/*** BoundedBufList ***/
+BoundedBufList::BoundedBufList() = default;
+BoundedBufList::BoundedBufList(BoundedBufList &&other) noexcept = default;
+BoundedBufList& BoundedBufList::operator=(BoundedBufList &&other) noexcept = default;
+BoundedBufList::~BoundedBufList() = default;
+
+
+/*** RawEntry ***/
+QByteArray RawEntry::toGzip() const
+{
+    if (method != Stored && method != Deflated)
+        return QByteArray();
+
+    // stored blocks: BFINAL/BTYPE byte, LEN, NLEN and up to 65535 bytes of data
+    static const int block_max = 0xFFFF;
+    const qint64 blocks = qMax<qint64>(1, (data.size() + block_max - 1) / block_max);
+    const qint64 body_size = (method == Deflated) ? data.size() : data.size() + blocks * 5;
+
+    QByteArray gzip;
+    gzip.reserve(10 + body_size + 8);
+
+    // header: ID1, ID2, CM (deflate), FLG, MTIME, XFL, OS (unknown)
+    char header[10] = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff' };
+    qToLittleEndian<quint32>(modified > 0 ? quint32(modified) : 0, header + 4);
+    gzip.append(header, sizeof(header));
+
+    if (method == Deflated) {
+        gzip.append(data);
+    } else {
+        for (qint64 i = 0; i < blocks; ++i) {
+            const qint64 offset = i * block_max;
+            const quint16 len = quint16(qMin<qint64>(block_max, data.size() - offset));
+            char block_header[5] = { char(i == blocks - 1 ? 1 : 0), 0, 0, 0, 0 };
+            qToLittleEndian<quint16>(len, block_header + 1);
+            qToLittleEndian<quint16>(quint16(~len), block_header + 3);
+            gzip.append(block_header, sizeof(block_header));
+            gzip.append(data.constData() + offset, len);
+        }
+    }
+
+    // trailer: CRC32, ISIZE
+    char trailer[8];
+    qToLittleEndian<quint32>(crc32, trailer);
+    qToLittleEndian<quint32>(quint32(sizeUncompressed), trailer + 4);
+    gzip.append(trailer, sizeof(trailer));
+
+    return gzip;
+}
+
+
+/*** ZipNames ***/
+// Returns the size of the parent folder part of the <path>: "folder/" for "folder/file.txt" and "folder/sub/"
+static int folderPartSize(const char *path, int size)
+{
+    for (int i = size - 2; i >= 0; --i) {
+        if (path[i] == '/')
+            return i + 1;
+    }
+
+    return 0;
+}
+
+void ZipNames::append(const QByteArray &path)
+{
+    rehash();
+
+    const int folder_size = folderPartSize(path.constData(), path.size());
+    const quint32 folder = addFolder(path.constData(), folder_size);
+    const char *name = path.constData() + folder_size;
+    const int name_size = path.size() - folder_size;
+
+    const qint32 index = qint32(m_items.size());
+    m_items.append(Item { folder, addToPool(name, name_size) });
+
+    // the later duplicate replaces the earlier one, just like in ZipContents
+    m_item_slots[itemSlot(folder, name, name_size)] = index;
+}
+
+void ZipNames::clear()
+{
+    m_pool = QByteArray();
+    m_items = QVector<Item>();
+    m_folders = QVector<Span>();
+    m_item_slots = QVector<qint32>();
+    m_folder_slots = QVector<qint32>();
+}
+
+void ZipNames::squeeze()
+{
+    m_pool.squeeze();
+    m_items.squeeze();
+    m_folders.squeeze();
+}
+
+int ZipNames::indexOf(const QByteArray &path) const
+{
+    if (m_items.isEmpty())
+        return -1;
+
+    const int folder_size = folderPartSize(path.constData(), path.size());
+    const qint32 folder = m_folder_slots.at(folderSlot(path.constData(), folder_size));
+    if (folder < 0)
+        return -1;
+
+    return m_item_slots.at(itemSlot(folder, path.constData() + folder_size, path.size() - folder_size));
+}
+
+QByteArray ZipNames::folderView(int index) const
+{
+    return view(m_folders.at(m_items.at(index).folder));
+}
+
+QByteArray ZipNames::fileNameView(int index) const
+{
+    return view(m_items.at(index).name);
+}
+
+QByteArray ZipNames::path(int index) const
+{
+    const Item &item = m_items.at(index);
+    return view(m_folders.at(item.folder)) + view(item.name);
+}
+
+qint64 ZipNames::memoryUsage() const
+{
+    return m_pool.capacity()
+           + m_items.capacity() * sizeof(Item)
+           + m_folders.capacity() * sizeof(Span)
+           + (m_item_slots.capacity() + m_folder_slots.capacity()) * sizeof(qint32);
+}
+
+QByteArray ZipNames::view(const Span &span) const
+{
+    return QByteArray::fromRawData(m_pool.constData() + span.offset, span.size);
+}
+
+int ZipNames::itemSlot(quint32 folder, const char *name, int size) const
+{
+    const int mask = int(m_item_slots.size()) - 1;
+    int slot = int(qHashBits(name, size, folder) & mask);
+
+    // linear probing
+    while (true) {
+        const qint32 index = m_item_slots.at(slot);
+        if (index < 0)
+            return slot;
+
+        const Item &item = m_items.at(index);
+        if (item.folder == folder && int(item.name.size) == size
+            && std::memcmp(m_pool.constData() + item.name.offset, name, size) == 0)
+        {
+            return slot;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+int ZipNames::folderSlot(const char *path, int size) const
+{
+    const int mask = int(m_folder_slots.size()) - 1;
+    int slot = int(qHashBits(path, size) & mask);
+
+    while (true) {
+        const qint32 folder = m_folder_slots.at(slot);
+        if (folder < 0)
+            return slot;
+
+        const Span &span = m_folders.at(folder);
+        if (int(span.size) == size
+            && std::memcmp(m_pool.constData() + span.offset, path, size) == 0)
+        {
+            return slot;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+quint32 ZipNames::addFolder(const char *path, int size)
+{
+    const int slot = folderSlot(path, size);
+    if (m_folder_slots.at(slot) < 0) {
+        m_folder_slots[slot] = qint32(m_folders.size());
+        m_folders.append(addToPool(path, size));
+    }
+
+    return quint32(m_folder_slots.at(slot));
+}
+
+ZipNames::Span ZipNames::addToPool(const char *data, int size)
+{
+    const Span span { quint32(m_pool.size()), quint32(size) };
+    m_pool.append(data, size);
+    return span;
+}
+
+void ZipNames::rehash()
+{
+    // keeps the load factor <= 0.5 after the next append (one entry, at most one folder)
+    auto grow = [](QVector<qint32> &table, int count) {
+        if ((count + 1) * 2 <= table.size())
+            return false;
+
+        int new_size = qMax(16, int(table.size()) * 2);
+        while ((count + 1) * 2 > new_size)
+            new_size *= 2;
+
+        table = QVector<qint32>(new_size, -1);
+        return true;
+    }; // lambda grow
+
+    if (grow(m_item_slots, int(m_items.size()))) {
+        for (int i = 0; i < m_items.size(); ++i) {
+            const Item &item = m_items.at(i);
+            m_item_slots[itemSlot(item.folder, m_pool.constData() + item.name.offset, item.name.size)] = i;
+        }
+    }
+
+    if (grow(m_folder_slots, int(m_folders.size()))) {
+        for (int i = 0; i < m_folders.size(); ++i) {
+            const Span &span = m_folders.at(i);
+            m_folder_slots[folderSlot(m_pool.constData() + span.offset, span.size)] = i;
+        }
+    }
+}
+
+
+/*** ZipArchive ***/
+ZipArchive::ZipArchive(ZipArchive &&other) noexcept
+    : m_archive(other.m_archive),
+      m_verbose(other.m_verbose),
+      m_zip_path(std::move(other.m_zip_path))
+{
+    other.m_archive = nullptr;
+}
+
+ZipArchive& ZipArchive::operator=(ZipArchive &&other) noexcept
+{
+    std::swap(m_archive, other.m_archive);
+    std::swap(m_verbose, other.m_verbose);
+    m_zip_path.swap(other.m_zip_path);
+    return *this;
+}
+
+const QString& ZipArchive::zipFilePath() const
+{
+    return m_zip_path;
+}
+
+qint64 ZipArchive::sizeCompressed() const
+{
+    return PZIP ? PZIP->m_archive_size : 0;
+}
+
+qint64 ZipArchive::sizeUncompressed() const
+{
+    qint64 total_size = 0;
+
+    for (const EntryInfo &entry : entries()) {
+        total_size += entry.sizeUncompressed;
+    }
+
+    return total_size;
+}
+
+int ZipArchive::count() const
+{
+    return mz_zip_reader_get_num_files(PZIP);
+}
+
+bool ZipArchive::isFolder(int index) const
+{
+    return isFolderName(name(index));
+}
+
+bool ZipArchive::isFile(int index) const
+{
+    return isFileName(name(index));
+}
+
+QString ZipArchive::name(int index) const
+{
+    mz_zip_archive_file_stat file_stat;
+    if (mz_zip_reader_file_stat(PZIP, index, &file_stat))
+        return file_stat.m_filename;
+
+    return QString();
+}
+
+qint64 ZipArchive::sizeCompressed(int index) const
+{
+    mz_zip_archive_file_stat file_stat;
+    if (mz_zip_reader_file_stat(PZIP, index, &file_stat))
+        return file_stat.m_comp_size;
+
+    return 0;
+}
+
+qint64 ZipArchive::sizeUncompressed(int index) const
+{
+    mz_zip_archive_file_stat file_stat;
+    if (mz_zip_reader_file_stat(PZIP, index, &file_stat))
+        return file_stat.m_uncomp_size;
+
+    return 0;
+}
+
+QDateTime ZipArchive::lastModified(int index) const
+{
+    qint64 sec = 0;
+
+    mz_zip_archive_file_stat file_stat;
+    if (mz_zip_reader_file_stat(PZIP, index, &file_stat))
+        sec = file_stat.m_time;
+
+    return sec > 0 ? QDateTime::fromSecsSinceEpoch(sec) : QDateTime();
+}
+
+EntryInfo ZipArchive::entryInfo(int index) const
+{
+    EntryInfo info;
+    readEntryInfo(index, info);
+    return info;
+}
+
+bool ZipArchive::readEntryInfo(int index, EntryInfo &info) const
+{
+    mz_zip_archive_file_stat file_stat;
+    if (index < 0 || !mz_zip_reader_file_stat(PZIP, index, &file_stat)) {
+        info = EntryInfo();
+        return false;
+    }
+
+    const int name_size = int(std::strlen(file_stat.m_filename));
+
+    // the capacity is kept while the buffer is not shared
+    info.rawName.resize(name_size);
+    std::memcpy(info.rawName.data(), file_stat.m_filename, name_size);
+
+    info.index = index;
+    info.isFolder = info.rawName.endsWith('/');
+    info.sizeCompressed = file_stat.m_comp_size;
+    info.sizeUncompressed = file_stat.m_uncomp_size;
+    info.crc32 = file_stat.m_crc32;
+    info.modified = file_stat.m_time;
+    return true;
+}
+
+void ZipArchive::setVerbose(bool enable)
+{
+    m_verbose = enable;
+}
+
+
+/*** ZipArchive::Entries ***/
+ZipArchive::Entries::const_iterator::const_iterator(const ZipArchive *archive, int index)
+    : m_archive(archive), m_index(index)
+{
+    if (m_index < m_archive->count())
+        m_archive->readEntryInfo(m_index, m_info);
+}
+
+ZipArchive::Entries::const_iterator& ZipArchive::Entries::const_iterator::operator++()
+{
+    if (++m_index < m_archive->count())
+        m_archive->readEntryInfo(m_index, m_info);
+
+    return *this;
+}
+
+
+/*** EntryInfo ***/
+QDateTime EntryInfo::lastModified() const
+{
+    return modified > 0 ? QDateTime::fromSecsSinceEpoch(modified) : QDateTime();
+}
+
+
+/*** ZipReader ***/
+ZipReader::ZipReader(const char *zipPath)
+{
+    open(QString(zipPath));
+}
+
+ZipReader::ZipReader(const QString &zipPath)
+{
+    open(zipPath);
+}
+
+ZipReader::ZipReader(const QByteArray &bufferedZip)
+{
+    openBuffer(bufferedZip);
+}
+
+ZipReader::ZipReader(ZipReader &&other) noexcept
+    : ZipArchive(std::move(other)),
+      m_buffer(std::move(other.m_buffer)),
+      m_buffer_offset(std::exchange(other.m_buffer_offset, 0)),
+      m_map_file(std::move(other.m_map_file)),
+      m_mapped(std::exchange(other.m_mapped, nullptr)),
+      m_contents(std::move(other.m_contents)),
+      m_names(std::move(other.m_names))
+{}
+
+ZipReader& ZipReader::operator=(ZipReader &&other) noexcept
+{
+    ZipArchive::operator=(std::move(other));
+    m_buffer.swap(other.m_buffer);
+    std::swap(m_buffer_offset, other.m_buffer_offset);
+    m_map_file.swap(other.m_map_file);
+    std::swap(m_mapped, other.m_mapped);
+    std::swap(m_contents, other.m_contents);
+    std::swap(m_names, other.m_names);
+    return *this;
+}
+
+ZipReader::~ZipReader()
+{
+    close();
+}
+
+bool ZipReader::open(const QString &zipPath)
+{
+    return openFile(zipPath, 0, 0);
+}
+
+bool ZipReader::openFile(const QString &zipPath, qint64 offset, qint64 size)
+{
+    // close the currently opened one if any
+    close();
+
+    mz_zip_archive *pZip = new mz_zip_archive();
+    QByteArray zipPathBytes = zipPath.toUtf8();
+    bool success = false;
+
+    {
+        TRACE_SPAN("open", zipPath);
+        StatsTimer timer(&QMicroz::Stats::indexNs);
+        success = mz_zip_reader_init_file_v2(pZip, zipPathBytes.constData(), 0, offset, size);
+    }
+
+    if (!success) {
+        qWarning() << "QMicroz: Failed to open zip file:" << zipPath;
+        delete pZip;
+        return false;
+    }
+
+    hookFileIo(pZip);
+    m_archive = pZip;
+    m_zip_path = zipPath;
+    return true;
+}
+
+bool ZipReader::openBuffer(const QByteArray &bufferedZip)
+{
+    return openBuffer(bufferedZip, 0, bufferedZip.size());
+}
+
+bool ZipReader::openBuffer(const QByteArray &buffer, qint64 offset, qint64 size)
+{
+    const QByteArray bufferedZip = QByteArray::fromRawData(buffer.constData() + offset, size);
+
+    if (!QMicroz::isArchive(bufferedZip)) {
+        qWarning() << "QMicroz: The byte array is not zipped";
+        return false;
+    }
+
+    // open zip archive
+    mz_zip_archive *pZip = new mz_zip_archive();
+    bool success = false;
+
+    {
+        TRACE_SPAN("open");
+        StatsTimer timer(&QMicroz::Stats::indexNs);
+        success = mz_zip_reader_init_mem(pZip, bufferedZip.constData(), bufferedZip.size(), 0);
+    }
+
+    if (success) {
+        // close the currently opened one if any
+        close();
+
+        // set the new one
+        m_archive = pZip;
+        m_buffer = buffer;
+        m_buffer_offset = offset;
+        return true;
+    }
+
+    qWarning() << "QMicroz: Failed to open buffered zip";
+    delete pZip;
+    return false;
+}
+
+void ZipReader::close()
+{
+    if (!m_archive)
+        return;
+
+    endArchive(PZIP);
+    m_archive = nullptr;
+    m_buffer.clear();
+    m_buffer_offset = 0;
+    m_map_file.reset(); // unmaps
+    m_mapped = nullptr;
+    m_contents.clear();
+    m_names.clear();
+    m_zip_path.clear();
+}
+
+ZipReader ZipReader::openNested(int index) const
+{
+    ZipReader nested;
+
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return nested;
+    }
+
+    mz_zip_archive_file_stat file_stat;
+    if (!mz_zip_reader_file_stat(PZIP, index, &file_stat) || isFolderName(file_stat.m_filename))
+        return nested;
+
+    if (file_stat.m_method == 0) {
+        // the stored archive is read in place
+        const qint64 offset = dataOffset(index);
+
+        const qint64 size = file_stat.m_comp_size;
+
+        if (offset >= 0 && size > 0) {
+            if (m_buffer.isEmpty())
+                nested.openFile(m_zip_path, offset, size);
+            else if (fitsBuffer(size) && m_buffer_offset + offset + size <= m_buffer.size()) // the local header is not trusted
+                nested.openBuffer(m_buffer, m_buffer_offset + offset, size);
+        }
+    } else {
+        // the deflated one is inflated once, the nested reader owns the data
+        nested.openBuffer(extractData(index));
+    }
+
+    if (!nested.isOpen())
+        qWarning() << "QMicroz: Failed to open nested archive:" << index << file_stat.m_filename;
+
+    return nested;
+}
+
+const ZipContents& ZipReader::contents() const
+{
+    auto updateContents = [this] {
+        m_contents.clear();
+
+        // iterating...
+        for (const EntryInfo &entry : entries()) {
+            if (!entry.rawName.isEmpty())
+                m_contents[entry.name()] = entry.index;
+        }
+    }; // lambda
+
+    // not cached yet
+    if (m_contents.isEmpty() && isOpen()) {
+        TRACE_SPAN("index");
+        StatsTimer timer(&QMicroz::Stats::indexNs);
+        updateContents();
+    }
+
+    return m_contents;
+}
+
+const ZipNames& ZipReader::names() const
+{
+    // not cached yet
+    if (m_names.isEmpty() && isOpen()) {
+        TRACE_SPAN("index");
+        StatsTimer timer(&QMicroz::Stats::indexNs);
+
+        for (const EntryInfo &entry : entries()) {
+            m_names.append(entry.rawName);
+        }
+
+        m_names.squeeze();
+    }
+
+    return m_names;
+}
+
+int ZipReader::findIndex(const QString &fileName) const
+{
+    const ZipNames &entry_names = names();
+    const QByteArray name = fileName.toUtf8();
+
+    // full path matching
+    int index = entry_names.indexOf(name);
+    if (index >= 0)
+        return index;
+
+    // deep search, matching only the name, e.g. "file.txt" for "folder/file.txt"
+    // the first match in the order of the paths, as in the ZipContents
+    if (!fileName.contains(s_sep)) {
+        QString found_path;
+
+        for (int i = 0; i < entry_names.size(); ++i) {
+            if (entry_names.fileNameView(i) != name)
+                continue;
+
+            // the later duplicate replaces the earlier one
+            const QString path = entry_names.name(i);
+            if (index < 0 || !(found_path < path)) {
+                index = i;
+                found_path = path;
+            }
+        }
+
+        if (index >= 0)
+            return index;
+    }
+
+    qDebug() << "QMicroz: Index not found:" << fileName;
+    return -1;
+}
+
+bool ZipReader::extractAll(const QString &outputFolder) const
+{
+    int num = 0;
+
+    for (int i = 0; i < count(); ++i) {
+        if (extractToFolder(i, outputFolder))
+            ++num;
+    }
+
+    return num > 0 && num == count();
+}
+
+Manifest ZipReader::extractAll(const QString &outputFolder, const DigestList &algorithms, int threads) const
+{
+    QVector<int> indexes(count());
+    std::iota(indexes.begin(), indexes.end(), 0);
+
+    auto extract = [&](const ZipReader &reader, int num, FileDigester *digester) {
+        return reader.extractToFolder(indexes.at(num), outputFolder, digester);
+    };
+
+    return extractManifest(indexes, extract, algorithms, threads);
+}
+
+Manifest ZipReader::extractManifest(const QVector<int> &indexes,
+                                    const std::function<bool(const ZipReader &, int, FileDigester *)> &extract,
+                                    const DigestList &algorithms, int threads) const
+{
+    Manifest manifest;
+    manifest.algorithms = algorithms;
+
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return manifest;
+    }
+
+    if (threads <= 0)
+        threads = qMax(1, QThread::idealThreadCount());
+
+    /* The entries with the same name are written to the same path, so they are chained
+     * and extracted in order by one thread: the later one replaces the earlier, as sequentially.
+     */
+    QVector<int> next_same(indexes.size(), -1);  // the next job with the same name
+    QVector<bool> chained(indexes.size(), false); // extracted after a previous job
+    QHash<QByteArray, int> last_same;            // { name : the last job with it }
+    EntryInfo info;
+
+    for (int num = 0; num < indexes.size(); ++num) {
+        if (!readEntryInfo(indexes.at(num), info))
+            continue;
+
+        auto it = last_same.find(info.rawName);
+
+        if (it != last_same.end()) {
+            next_same[it.value()] = num;
+            chained[num] = true;
+            it.value() = num;
+        } else {
+            last_same.insert(info.rawName, num);
+        }
+    }
+
+    // each thread fills the places of its entries
+    QVector<ManifestEntry> files(indexes.size());
+    ManifestEntry *places = files.data();
+    std::atomic<int> next { 0 };
+    std::atomic<bool> failed { false };
+
+    auto worker = [&](const ZipReader &reader) {
+        if (!reader.isOpen()) {
+            failed = true;
+            return;
+        }
+
+        FileDigester digester(algorithms);
+        int first = 0;
+
+        while ((first = next++) < indexes.size()) {
+            if (chained.at(first))
+                continue;
+
+            for (int num = first; num >= 0; num = next_same.at(num)) {
+                if (!extract(reader, num, &digester)) {
+                    failed = true;
+                    continue;
+                }
+
+                const EntryInfo entry = reader.entryInfo(indexes.at(num));
+                if (!entry.isFile())
+                    continue;
+
+                ManifestEntry &file = places[num];
+                file.index = entry.index;
+                file.name = entry.name();
+                file.size = entry.sizeUncompressed;
+                file.crc32 = entry.crc32;
+                file.digests = digester.results();
+            }
+        }
+    }; // lambda worker
+
+    WorkersStats workers_stats;
+
+    // the calling thread extracts too, through this reader
+    std::vector<std::thread> workers;
+    for (int i = 1; i < qMin<int>(threads, indexes.size()); ++i) {
+        workers.emplace_back([&]() {
+            worker(duplicate());
+            workers_stats.collect();
+        });
+    }
+
+    worker(*this);
+
+    for (std::thread &thread : workers) {
+        thread.join();
+    }
+
+    workers_stats.merge();
+
+    for (const ManifestEntry &file : files) {
+        if (file.index >= 0)
+            manifest.files.append(file);
+    }
+
+    manifest.success = !failed && !indexes.isEmpty();
+    return manifest;
+}
+
+// CRC-32 as the mz_crc32, by slicing-by-8: several times faster on the large data than its byte-wise table
+static quint32 crc32Fast(quint32 crc, const uchar *data, qint64 size)
+{
+    using Tables = std::array<std::array<quint32, 256>, 8>;
+
+    static const Tables t = [] {
+        Tables tables {};
+
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c >> 1) ^ (0xedb88320 & (0u - (c & 1)));
+            }
+            tables[0][i] = c;
+        }
+
+        for (int i = 0; i < 256; ++i) {
+            for (int s = 1; s < 8; ++s) {
+                tables[s][i] = (tables[s - 1][i] >> 8) ^ tables[0][tables[s - 1][i] & 0xff];
+            }
+        }
+
+        return tables;
+    }();
+
+    crc = ~crc;
+
+    for (; size >= 8; data += 8, size -= 8) {
+        const quint32 lo = qFromLittleEndian<quint32>(data) ^ crc;
+        const quint32 hi = qFromLittleEndian<quint32>(data + 4);
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+              ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+    }
+
+    return ~crc;
+}
+
+// Whether the <filePath> file has the contents of the <entry>: the size and date, and the CRC-32 if <verifyCrc>
+static bool isUpToDate(const EntryInfo &entry, const QString &filePath, bool verifyCrc)
+{
+    StatsTimer timer(&QMicroz::Stats::fileIoNs);
+    const QFileInfo fi(filePath);
+
+    if (entry.isFolder)
+        return fi.isDir();
+
+    if (!fi.isFile() || fi.size() != entry.sizeUncompressed
+        || (entry.modified > 0 && fi.lastModified().toSecsSinceEpoch() != entry.modified))
+    {
+        return false;
+    }
+
+    if (!verifyCrc)
+        return true;
+
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    QByteArray chunk(MZ_ZIP_MAX_IO_BUF_SIZE, Qt::Uninitialized);
+    quint32 crc = MZ_CRC32_INIT;
+    qint64 read = 0;
+
+    while ((read = file.read(chunk.data(), chunk.size())) > 0) {
+        StatsTimer crc_timer(&QMicroz::Stats::crcNs);
+        crc = crc32Fast(crc, reinterpret_cast<const uchar *>(chunk.constData()), read);
+    }
+
+    return read == 0 && crc == entry.crc32;
+}
+
+// Returns the path of the <entryName> in the <outputFolder>; empty if it leads outside the folder
+static QString outputPathOf(const QString &outputFolder, const QString &entryName)
+{
+    const QString outputPath = joinPath(outputFolder, entryName);
+
+#if defined(CHECK_PATH_TRAVERSAL)
+    const QString canonical = QFileInfo(outputPath).absolutePath();
+
+    // Protection against placing a file outside the output folder.
+    // E.g. "../../file" entry inside the archive.
+    if (!canonical.startsWith(outputFolder)) {
+        qWarning() << "QMicroz: Path traversal attempt blocked:" << entryName;
+        return QString();
+    }
+#endif
+
+    return outputPath;
+}
+
+bool ZipReader::updateAll(const QString &outputFolder, bool verifyCrc) const
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    if (outputFolder.isEmpty())
+        return false;
+
+    int num = 0;
+
+    for (const EntryInfo &entry : entries()) {
+        // checked before the existing file is compared, as by extractToFolder
+        const QString outputPath = outputPathOf(outputFolder, entry.name());
+        if (outputPath.isEmpty())
+            continue;
+
+        if (isUpToDate(entry, outputPath, verifyCrc)) {
+            if (m_verbose)
+                std::cout << "Up to date: " << entry.rawName.constData() << std::endl;
+            ++num;
+        } else if (extractIndex(entry.index, outputPath)) {
+            ++num;
+        }
+    }
+
+    return num > 0 && num == count();
+}
+
+bool ZipReader::extractToFolder(int index, const QString &outputFolder) const
+{
+    return extractToFolder(index, outputFolder, nullptr);
+}
+
+bool ZipReader::extractToFolder(int index, const QString &outputFolder, FileDigester *digester) const
+{
+    if (outputFolder.isEmpty())
+        return false;
+
+    const QString outputPath = outputPathOf(outputFolder, name(index));
+    if (outputPath.isEmpty())
+        return false;
+
+    return extractIndex(index, outputPath, digester);
+}
+
+bool ZipReader::extractIndex(int index, const QString &outputPath) const
+{
+    return extractIndex(index, outputPath, nullptr);
+}
+
+bool ZipReader::extractIndex(int index, const QString &outputPath, FileDigester *digester) const
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    if (index == -1)
+        return false;
+
+    // the name is also a path inside the archive
+    const QString filename = name(index);
+    if (filename.isEmpty())
+        return false;
+
+    auto createFolder = [](const QString &path) {
+        TRACE_SPAN("mkdir", path);
+        StatsTimer timer(&QMicroz::Stats::mkdirNs);
+
+        if (QFileInfo::exists(path) || QDir().mkpath(path))
+            return true;
+
+        qWarning() << "QMicroz: Failed to create directory:" << path;
+        return false;
+    }; // lambda createFolder -> bool
+
+    if (isFileName(filename)) {
+        if (m_verbose)
+            std::cout << "Extracting: " << filename.toStdString();
+
+        const QString parent_folder = QFileInfo(outputPath).absolutePath();
+
+        // create parent folder on disk if not any
+        if (!createFolder(parent_folder))
+            return false;
+
+        // extracting...
+        mz_zip_archive_file_stat file_stat;
+        QFile file(outputPath);
+        bool res = mz_zip_reader_file_stat(PZIP, index, &file_stat);
+
+        /* large deflated files are inflated into the mapping, which needs the read access;
+         * the declared size is preallocated, so not if it's more than the compressed data can give
+         */
+        const bool large = res && file_stat.m_method == MZ_DEFLATED && (qint64)file_stat.m_uncomp_size >= s_map_min_size
+                           && (qint64)file_stat.m_uncomp_size <= (qint64)file_stat.m_comp_size * s_max_deflate_ratio;
+
+        if (res) {
+            StatsTimer timer(&QMicroz::Stats::fileIoNs);
+            res = file.open(large ? (QFile::ReadWrite | QFile::Truncate) : QFile::WriteOnly);
+        }
+
+        // the stored data is copied in the kernel if possible; not if it is to be digested
+        const bool copied = res && !digester && file_stat.m_method == 0 && file_stat.m_comp_size > 0
+                            && copyStored(index, file.handle()) == (qint64)file_stat.m_comp_size;
+
+        if (res && !copied && file.size() > 0) {
+            // rewrite a partial copy
+            res = file.resize(0) && file.seek(0);
+        }
+
+        if (res && !copied) {
+            TRACE_SPAN("inflate", filename);
+            StatsTimer timer(&QMicroz::Stats::inflateNs);
+
+            if (digester) {
+                digester->reset();
+                digester->file = &file;
+            }
+
+            bool mapped = false;
+            if (large)
+                res = inflateToMapped(PZIP, index, file, file_stat.m_uncomp_size, digester, mapped);
+
+            if (!mapped) {
+                // no mapping (or a failed one): falls back to the streaming decoder; a failed decoding is not retried
+                res = (!large || (file.resize(0) && file.seek(0)))
+                      && (digester ? mz_zip_reader_extract_to_callback(PZIP, index, writeAndDigest, digester, 0)
+                                   : mz_zip_reader_extract_to_callback(PZIP, index, writeToFile, &file, 0));
+            }
+        }
+
+        if (res) {
+            StatsTimer timer(&QMicroz::Stats::fileIoNs);
+            if (file_stat.m_time > 0)
+                file.setFileTime(QDateTime::fromSecsSinceEpoch(file_stat.m_time), QFileDevice::FileModificationTime);
+            file.close();
+            countEntry(file_stat.m_comp_size, file_stat.m_uncomp_size);
+        }
+
+        if (m_verbose) {
+            std::cout << CH_SPACE << (res ? RESULT_OK : RESULT_FAILED) << std::endl;
+        } else if (!res) {
+            qWarning() << "QMicroz: Failed to extract file:" << index << filename;
+        }
+
+        return res;
+    }
+
+    // <filename> is a folder entry
+    return createFolder(outputPath);
+}
+
+bool ZipReader::extractFolder(const QString &folderName, const QString &outputPath) const
+{
+    bool extracted = false;
+    QString folder_entry = toFolderName(folderName);
+    const ZipContents &entries = contents();
+    ZipContents::const_iterator it = entries.constBegin();
+
+    for (; it != entries.constEnd(); ++it) {
+        if (it.key().startsWith(folder_entry)) {
+            // e.g. "folder_entry/file" --> "file"
+            QString relPath = it.key().mid(folder_entry.size());
+
+            if (extractIndex(it.value(), joinPath(outputPath, relPath)))
+                extracted = true;
+        }
+    }
+
+    return extracted;
+}
+
+Manifest ZipReader::extractFolder(const QString &folderName, const QString &outputPath,
+                                  const DigestList &algorithms, int threads) const
+{
+    const QString folder_entry = toFolderName(folderName);
+    const ZipContents &entries = contents();
+    QVector<int> indexes;
+    QStringList paths;
+
+    for (ZipContents::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        if (it.key().startsWith(folder_entry)) {
+            indexes.append(it.value());
+            paths.append(joinPath(outputPath, it.key().mid(folder_entry.size())));
+        }
+    }
+
+    auto extract = [&](const ZipReader &reader, int num, FileDigester *digester) {
+        return reader.extractIndex(indexes.at(num), paths.at(num), digester);
+    };
+
+    return extractManifest(indexes, extract, algorithms, threads);
+}
+
+BufList ZipReader::extractToBuf() const
+{
+    BufList res;
+    const ZipContents &entries = contents();
+
+    // extracting...
+    ZipContents::const_iterator it = entries.constBegin();
+    for (; it != entries.constEnd(); ++it) {
+        res[it.key()] = extractData(it.value());
+    }
+
+    return res;
+}
+
+BufFile ZipReader::extractToBuf(int index) const
+{
+    const QString entryName = name(index);
+    if (entryName.isEmpty())
+        return BufFile();
+
+    BufFile bufFile(entryName);
+    bufFile.data = extractData(index);
+    bufFile.modified = lastModified(index);
+
+    return bufFile;
+}
+
+BoundedBufList ZipReader::extractToBufBounded(qint64 memoryBudget, const QString &spillFolder) const
+{
+    BoundedBufList res;
+
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return res;
+    }
+
+    // the files written to the spill file: { name : { offset, size } }
+    QMap<QString, QPair<qint64, qint64>> spilled;
+
+    // the later entry with the same name replaces the earlier one, as in extractToBuf, whichever store it is in
+    auto replace = [&](const QString &name) {
+        if (res.m_list.contains(name))
+            res.m_memory_size -= res.m_list.take(name).size();
+        if (spilled.contains(name))
+            res.m_spilled_size -= spilled.take(name).second;
+    }; // lambda replace
+
+    for (const EntryInfo &entry : entries()) {
+        if (entry.isFolder) {
+            res.m_list[entry.name()] = QByteArray();
+            continue;
+        }
+
+        // fits the budget; a bogus (negative) declared size is spilled and checked by the inflater
+        if (entry.sizeUncompressed >= 0 && res.m_memory_size + entry.sizeUncompressed <= memoryBudget) {
+            const QByteArray data = extractData(entry.index);
+            if (!data.isNull()) {
+                replace(entry.name());
+                res.m_list[entry.name()] = data;
+                res.m_memory_size += data.size();
+            }
+            continue;
+        }
+
+        // spilling...
+        if (!res.m_spill_file) {
+            const QString folder = spillFolder.isEmpty() ? QDir::tempPath() : spillFolder;
+            res.m_spill_file.reset(new QTemporaryFile(joinPath(folder, QStringLiteral(u"qmicroz_XXXXXX.spill"))));
+
+            if (!res.m_spill_file->open()) {
+                qWarning() << "QMicroz: Failed to create spill file in:" << folder;
+                res.m_spill_file.reset();
+                return res;
+            }
+        }
+
+        // the spilled data is viewed by a QByteArray
+        if (!fitsBuffer(entry.sizeUncompressed)) {
+            qWarning() << "QMicroz: File is too large for the buffer:" << entry.index << entry.name();
+            continue;
+        }
+
+        if (m_verbose)
+            std::cout << "Spilling: " << entry.rawName.constData();
+
+        const qint64 offset = res.m_spill_file->pos();
+        bool extracted = false;
+
+        {
+            TRACE_SPAN("inflate", entry.name());
+            StatsTimer timer(&QMicroz::Stats::inflateNs);
+            extracted = mz_zip_reader_extract_to_callback(PZIP, entry.index, writeToFile,
+                                                          res.m_spill_file.get(), 0);
+        }
+
+        if (m_verbose)
+            std::cout << CH_SPACE << (extracted ? RESULT_OK : RESULT_FAILED) << std::endl;
+
+        // the real inflated size, not the declared one
+        const qint64 written = res.m_spill_file->pos() - offset;
+
+        if (!extracted || written != entry.sizeUncompressed) {
+            qWarning() << "QMicroz: Failed to extract file:" << entry.index << entry.name();
+
+            // drops the partially written data
+            if (!res.m_spill_file->resize(offset) || !res.m_spill_file->seek(offset)) {
+                qWarning() << "QMicroz: Failed to truncate spill file:" << res.m_spill_file->fileName();
+                return BoundedBufList();
+            }
+            continue;
+        }
+
+        countEntry(entry.sizeCompressed, written);
+        replace(entry.name());
+        spilled[entry.name()] = qMakePair(offset, written);
+        res.m_spilled_size += written;
+    }
+
+    if (spilled.isEmpty())
+        return res;
+
+    // the file size is final, so map it once
+    const qint64 spill_size = res.m_spill_file->pos();
+    static const char empty = '\0';
+    const char *mapped = spill_size > 0 ? nullptr : &empty; // only empty files spilled
+
+    if (spill_size > 0) {
+        StatsTimer timer(&QMicroz::Stats::fileIoNs);
+        if (res.m_spill_file->flush())
+            mapped = reinterpret_cast<const char *>(res.m_spill_file->map(0, spill_size));
+    }
+
+    if (!mapped) {
+        qWarning() << "QMicroz: Failed to map spill file:" << res.m_spill_file->fileName();
+        for (auto it = spilled.constBegin(); it != spilled.constEnd(); ++it)
+            qWarning() << "QMicroz: Missing spilled file:" << it.key();
+
+        res.m_spilled_size = 0;
+        res.m_spill_file.reset();
+        return res;
+    }
+
+    for (auto it = spilled.constBegin(); it != spilled.constEnd(); ++it) {
+        res.m_list[it.key()] = QByteArray::fromRawData(mapped + it.value().first, it.value().second);
+    }
+
+    return res;
+}
+
+QByteArray ZipReader::extractData(int index) const
+{
+    // Pointer to data
+    QByteArray extrRef = extractDataRef(index);
+
+    if (extrRef.isNull())
+        return QByteArray();
+
+    // Copy data
+    QByteArray extrCopy(extrRef.constData(), extrRef.size());
+
+    // Clear extracted from the heap
+    free((void*)extrRef.constData());
+
+    return extrCopy;
+}
+
+QByteArray ZipReader::extractDataRef(int index) const
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return QByteArray();
+    }
+
+    /* When extracting a folder, the <mz_zip_reader_extract_to_heap>
+     * returns an empty array, but not a null pointer.
+     * So for convenience, at the moment we return a null array for folders.
+     * QByteArray().isNull();   // returns true
+     * QByteArray("").isNull(); // returns false
+     */
+    if (isFolder(index))
+        return QByteArray();
+
+    if (m_verbose)
+        std::cout << "Extracting: " << name(index).toStdString();
+
+    // extracting...
+    size_t data_size = 0;
+    char *ch_data = nullptr;
+
+    {
+        TRACE_SPAN("inflate", name(index));
+        StatsTimer timer(&QMicroz::Stats::inflateNs);
+        ch_data = (char*)mz_zip_reader_extract_to_heap(PZIP, index, &data_size, 0);
+    }
+
+    if (ch_data)
+        countEntry(sizeCompressed(index), data_size);
+
+    // Pointer to the data in the QByteArray.
+    // The Data should be deleted on the caller side: free((void*)ba.constData());
+    QByteArray extracted = ch_data ? QByteArray::fromRawData(ch_data, data_size) : QByteArray();
+
+    if (m_verbose)
+        std::cout << CH_SPACE << (ch_data ? RESULT_OK : RESULT_FAILED) << std::endl;
+
+    return extracted;
+}
+
+
+qint64 ZipReader::copyStored(int index, int fd) const
+{
+#if defined(Q_OS_LINUX)
+    // the zip file opened by miniz; not set for a buffered archive
+    MZ_FILE *zip_file = mz_zip_get_cfile(PZIP);
+    const qint64 offset = localDataOffset(PZIP, index);
+
+    mz_zip_archive_file_stat file_stat;
+
+    // below the threshold the mapping and the separate CRC pass cost more than the decoder's copy
+    if (!zip_file || offset < 0 || !mz_zip_reader_file_stat(PZIP, index, &file_stat)
+        || (qint64)file_stat.m_comp_size < s_copy_min_size)
+    {
+        return 0;
+    }
+
+    // the kernel copy bypasses the CRC check of the decoder, so the data is verified in the mapping first
+    const QByteArray data = mapStored(index);
+
+    if (data.isNull())
+        return 0;
+
+    {
+        StatsTimer timer(&QMicroz::Stats::crcNs);
+        if (crc32Fast(MZ_CRC32_INIT, reinterpret_cast<const uchar *>(data.constData()), data.size()) != file_stat.m_crc32)
+            return 0; // the decoder reports the mismatch
+    }
+
+    TRACE_SPAN("copy", name(index));
+    StatsTimer timer(&QMicroz::Stats::fileIoNs);
+    return copyInKernel(fileno(zip_file), mz_zip_get_archive_file_start_offset(PZIP) + offset,
+                        fd, sizeCompressed(index));
+#else
+    Q_UNUSED(index)
+    Q_UNUSED(fd)
+    return 0;
+#endif
+}
+
+bool ZipReader::extractToFd(int index, int fd) const
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    mz_zip_archive_file_stat file_stat;
+    if (!mz_zip_reader_file_stat(PZIP, index, &file_stat) || isFolderName(file_stat.m_filename))
+        return false;
+
+    bool res = false;
+
+    if (file_stat.m_method == 0) {
+        const qint64 copied = copyStored(index, fd);
+        res = copied == (qint64)file_stat.m_comp_size;
+
+        // can't rewind a socket, so only falls back if nothing is written
+        if (copied > 0 && !res) {
+            qWarning() << "QMicroz: Failed to copy file:" << index << file_stat.m_filename;
+            return false;
+        }
+    }
+
+    if (!res) {
+        QFile out;
+        if (!out.open(fd, QFile::WriteOnly | QFile::Unbuffered, QFile::DontCloseHandle))
+            return false;
+
+        TRACE_SPAN("inflate", file_stat.m_filename);
+        StatsTimer timer(&QMicroz::Stats::inflateNs);
+        res = mz_zip_reader_extract_to_callback(PZIP, index, writeToFile, &out, 0);
+    }
+
+    if (res)
+        countEntry(file_stat.m_comp_size, file_stat.m_uncomp_size);
+
+    return res;
+}
+
+RawEntry ZipReader::extractRaw(int index) const
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return RawEntry();
+    }
+
+    mz_zip_archive_file_stat file_stat;
+    if (!mz_zip_reader_file_stat(PZIP, index, &file_stat) || isFolderName(file_stat.m_filename))
+        return RawEntry();
+
+    if (!fitsBuffer(file_stat.m_comp_size)) {
+        qWarning() << "QMicroz: Compressed data is too large for the buffer:" << index << name(index);
+        return RawEntry();
+    }
+
+    RawEntry raw;
+    raw.method = file_stat.m_method;
+    raw.crc32 = file_stat.m_crc32;
+    raw.sizeUncompressed = file_stat.m_uncomp_size;
+    raw.modified = file_stat.m_time;
+    raw.data.resize(file_stat.m_comp_size);
+
+    bool res = false;
+
+    {
+        TRACE_SPAN("read raw", file_stat.m_filename);
+        StatsTimer timer(&QMicroz::Stats::fileIoNs);
+        res = mz_zip_reader_extract_to_mem_no_alloc(PZIP, index, raw.data.data(), raw.data.size(),
+                                                    MZ_ZIP_FLAG_COMPRESSED_DATA, NULL, 0);
+    }
+
+    if (!res) {
+        qWarning() << "QMicroz: Failed to read the compressed data:" << index << name(index);
+        return RawEntry();
+    }
+
+    // an empty file is still valid
+    if (raw.data.isNull())
+        raw.data = QByteArray("");
+
+    return raw;
+}
+
+int ZipReader::dataAlignment(int index) const
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return 0;
+    }
+
+    return localAlignment(PZIP, index);
+}
+
+qint64 ZipReader::dataOffset(int index) const
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return -1;
+    }
+
+    const qint64 offset = localDataOffset(PZIP, index);
+    return offset < 0 ? offset : mz_zip_get_archive_file_start_offset(PZIP) + offset;
+}
+
+QByteArray ZipReader::mapStored(int index) const
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return QByteArray();
+    }
+
+    mz_zip_archive_file_stat file_stat;
+    if (!mz_zip_reader_file_stat(PZIP, index, &file_stat) || file_stat.m_method != 0
+        || isFolderName(file_stat.m_filename))
+    {
+        return QByteArray();
+    }
+
+    const qint64 offset = dataOffset(index);
+    const qint64 size = file_stat.m_comp_size;
+
+    if (offset < 0 || !fitsBuffer(size))
+        return QByteArray();
+
+    if (!m_buffer.isEmpty()) {
+        if (m_buffer_offset + offset + size > m_buffer.size())
+            return QByteArray();
+
+        return QByteArray::fromRawData(m_buffer.constData() + m_buffer_offset + offset, size);
+    }
+
+    if (!m_mapped) {
+        TRACE_SPAN("map", m_zip_path);
+        StatsTimer timer(&QMicroz::Stats::fileIoNs);
+        std::unique_ptr<QFile> file(new QFile(m_zip_path));
+
+        if (!file->open(QFile::ReadOnly) || !(m_mapped = file->map(0, file->size()))) {
+            qWarning() << "QMicroz: Failed to map zip file:" << m_zip_path;
+            return QByteArray();
+        }
+
+        m_map_file = std::move(file);
+    }
+
+    if (offset + size > m_map_file->size())
+        return QByteArray();
+
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(m_mapped) + offset, size);
+}
+
+bool ZipReader::sameContent(int index, const ZipReader &other, int otherIndex) const
+{
+    StatsTimer timer(&QMicroz::Stats::inflateNs);
+    mz_zip_reader_extract_iter_state *iter = mz_zip_reader_extract_iter_new(PZIP, index, 0);
+    mz_zip_reader_extract_iter_state *other_iter = mz_zip_reader_extract_iter_new(
+        static_cast<mz_zip_archive *>(other.m_archive), otherIndex, 0);
+
+    bool same = iter && other_iter;
+
+    if (same) {
+        QByteArray chunk(MZ_ZIP_MAX_IO_BUF_SIZE, Qt::Uninitialized);
+        QByteArray other_chunk(MZ_ZIP_MAX_IO_BUF_SIZE, Qt::Uninitialized);
+        size_t read = 0;
+
+        // the iterators fill the whole buffer until the end of the data, so the chunks are aligned
+        do {
+            read = mz_zip_reader_extract_iter_read(iter, chunk.data(), chunk.size());
+            const size_t other_read = mz_zip_reader_extract_iter_read(other_iter, other_chunk.data(), other_chunk.size());
+            same = read == other_read && std::memcmp(chunk.constData(), other_chunk.constData(), read) == 0;
+        } while (same && read > 0);
+    }
+
+    // the CRC-32 is checked by the iterator on free
+    if (iter && !mz_zip_reader_extract_iter_free(iter))
+        same = false;
+    if (other_iter && !mz_zip_reader_extract_iter_free(other_iter))
+        same = false;
+
+    return same;
+}
+
+ArchiveDiff ZipReader::diff(const ZipReader &other, bool verifyContent) const
+{
+    ArchiveDiff result;
+
+    if (!isOpen() || !other.isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return result;
+    }
+
+    const ZipNames &other_names = other.names();
+    QVector<bool> matched(other.count(), false);
+    EntryInfo other_entry;
+
+    for (const EntryInfo &entry : entries()) {
+        const int other_index = other_names.indexOf(entry.rawName);
+
+        if (other_index < 0) {
+            result.removed << entry.name();
+            continue;
+        }
+
+        matched[other_index] = true;
+
+        if (!other.readEntryInfo(other_index, other_entry))
+            return result;
+
+        const bool same = entry.isFolder
+                          || (entry.sizeUncompressed == other_entry.sizeUncompressed
+                              && entry.crc32 == other_entry.crc32
+                              && (!verifyContent || sameContent(entry.index, other, other_index)));
+
+        if (same)
+            ++result.unchanged;
+        else
+            result.modified << entry.name();
+    }
+
+    for (int i = 0; i < matched.size(); ++i) {
+        if (!matched.at(i))
+            result.added << other.name(i);
+    }
+
+    result.success = true;
+    return result;
+}
+
+ZipReader ZipReader::duplicate() const
+{
+    ZipReader reader;
+
+    if (!isOpen())
+        return reader;
+
+    if (!m_buffer.isEmpty())
+        reader.openBuffer(m_buffer, m_buffer_offset, PZIP->m_archive_size);
+    else
+        reader.openFile(m_zip_path, mz_zip_get_archive_file_start_offset(PZIP), PZIP->m_archive_size);
+
+    return reader;
+}
+
+// Bytes of the data kept on each side of a search match
+static const int s_search_context = 32;
+
+// Searches the inflated data of an entry chunk by chunk
+struct SearchScanner {
+    SearchScanner(const QByteArrayMatcher &matcher, int patternSize, std::atomic<int> &firstHitIndex, bool firstOnly)
+        : matcher(matcher), pattern_size(patternSize), first_hit_index(firstHitIndex), first_only(firstOnly)
+    {
+        window.reserve(s_search_context + pattern_size + MZ_ZIP_MAX_IO_BUF_SIZE);
+    }
+
+    // Starts the entry with <entryIndex>; the buffer is kept
+    void reset(int entryIndex)
+    {
+        index = entryIndex;
+        hits.clear();
+        pending = 0;
+        found = false;
+        window.resize(0);
+        window_pos = 0;
+        next_from = 0;
+    }
+
+    // Whether the rest of the entry is not needed: a match is found in it or in an earlier entry
+    bool isDone() const
+    {
+        return found || first_hit_index.load(std::memory_order_relaxed) < index;
+    }
+
+    // Lowers the <first_hit_index> to the current entry
+    void markFound()
+    {
+        found = true;
+        int lowest = first_hit_index.load(std::memory_order_relaxed);
+        while (index < lowest && !first_hit_index.compare_exchange_weak(lowest, index)) {}
+    }
+
+    const QByteArrayMatcher &matcher;
+    const int pattern_size;
+    std::atomic<int> &first_hit_index;  // lowest index of the entry with a match; only if <first_only>
+    const bool first_only;
+
+    int index = -1;
+    QVector<SearchHit> hits;    // found in the entry
+    int pending = 0;            // number of the last hits still waiting for the data after the match
+    bool found = false;         // the first match of the entry is found; only if <first_only>
+    QByteArray window;          // tail of the previous data and the current chunk
+    qint64 window_pos = 0;      // offset of the <window> in the uncompressed data
+    qint64 next_from = 0;       // offset from which the matches are not searched yet
+};
+
+// Callback of <mz_zip_reader_extract_to_callback> searching each chunk
+static size_t searchChunk(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
+{
+    Q_UNUSED(file_ofs)
+    SearchScanner *sc = static_cast<SearchScanner *>(pOpaque);
+    const char *chunk = static_cast<const char *>(pBuf);
+
+    // completes the context of the matches near the end of the previous chunks; the chunks may be shorter than it
+    for (int i = sc->hits.size() - sc->pending; i < sc->hits.size(); ++i) {
+        SearchHit &hit = sc->hits[i];
+        const int missing = hit.contextPos + sc->pattern_size + s_search_context - hit.context.size();
+        hit.context.append(chunk, qMin<qint64>(missing, n));
+    }
+
+    // the earlier hits end earlier, so are completed first
+    while (sc->pending > 0) {
+        const SearchHit &hit = sc->hits.at(sc->hits.size() - sc->pending);
+        if (hit.context.size() < hit.contextPos + sc->pattern_size + s_search_context)
+            break;
+        --sc->pending;
+    }
+
+    // only the contexts are completed after the stop; 0 aborts the extraction
+    if (sc->isDone())
+        return sc->pending > 0 ? n : 0;
+
+    /* keeps enough of the previous data for the matches spanning the chunks and their context:
+     * at least <pattern_size> - 1 bytes, so the unsearched starts (from <next_from>) are in the window
+     * even after the chunks shorter than the pattern; less only while the data is shorter than that
+     */
+    const int keep = qMin<int>(sc->window.size(), s_search_context + sc->pattern_size - 1);
+    sc->window_pos += sc->window.size() - keep;
+    sc->window.remove(0, sc->window.size() - keep);
+    sc->window.append(chunk, n);
+
+    int pos = qMax<qint64>(0, sc->next_from - sc->window_pos);
+
+    while ((pos = sc->matcher.indexIn(sc->window.constData(), sc->window.size(), pos)) >= 0) {
+        const int start = qMax(0, pos - s_search_context);
+
+        SearchHit hit;
+        hit.index = sc->index;
+        hit.offset = sc->window_pos + pos;
+        hit.context = sc->window.mid(start, pos - start + sc->pattern_size + s_search_context);
+        hit.contextPos = pos - start;
+        sc->hits.append(hit);
+
+        if (hit.context.size() < hit.contextPos + sc->pattern_size + s_search_context)
+            ++sc->pending;
+
+        if (sc->first_only) {
+            sc->markFound();
+            break;
+        }
+
+        ++pos;
+    }
+
+    // the starts up to the end minus the pattern are searched; none while the window is shorter than the pattern
+    sc->next_from = qMax(sc->next_from, sc->window_pos + sc->window.size() - sc->pattern_size + 1);
+    return n;
+}
+
+QVector<SearchHit> ZipReader::search(const QByteArray &pattern, const EntryFilter &filter,
+                                     int threads, bool firstOnly) const
+{
+    QVector<SearchHit> hits;
+
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return hits;
+    }
+
+    if (pattern.isEmpty())
+        return hits;
+
+    if (threads <= 0)
+        threads = qMax(1, QThread::idealThreadCount());
+
+    const QByteArrayMatcher matcher(pattern);
+    const int num = count();
+    std::atomic<int> next { 0 };
+    std::atomic<int> first_hit_index { num }; // the entries after it are not searched if <firstOnly>
+    std::mutex mutex;
+
+    auto worker = [&](const ZipReader &reader) {
+        mz_zip_archive *pZip = static_cast<mz_zip_archive *>(reader.m_archive);
+        SearchScanner scanner(matcher, pattern.size(), first_hit_index, firstOnly);
+
+        while (pZip) {
+            // the indexes are taken in order, so all the earlier entries are being searched or done
+            const int index = next++;
+            if (index >= num || index > first_hit_index.load(std::memory_order_relaxed))
+                break;
+
+            const EntryInfo entry = reader.entryInfo(index);
+            if (entry.isFolder || (filter && !filter(entry)))
+                continue;
+
+            scanner.reset(index);
+            bool res = false;
+
+            {
+                TRACE_SPAN("search", entry.name());
+                StatsTimer timer(&QMicroz::Stats::inflateNs);
+                res = mz_zip_reader_extract_to_callback(pZip, index, searchChunk, &scanner, 0);
+            }
+
+            if (res)
+                countEntry(entry.sizeCompressed, entry.sizeUncompressed);
+            else if (!scanner.isDone())
+                qWarning() << "QMicroz: Failed to search file:" << index << entry.name();
+
+            if (!scanner.hits.isEmpty()) {
+                std::lock_guard<std::mutex> lock(mutex);
+                hits.append(scanner.hits);
+            }
+        }
+    }; // lambda worker
+
+    WorkersStats workers_stats;
+
+    // the calling thread searches too, through this reader
+    std::vector<std::thread> workers;
+    for (int i = 1; i < qMin(threads, num); ++i) {
+        workers.emplace_back([&]() {
+            worker(duplicate());
+            workers_stats.collect();
+        });
+    }
+
+    worker(*this);
+
+    for (std::thread &thread : workers) {
+        thread.join();
+    }
+
+    workers_stats.merge();
+
+    std::sort(hits.begin(), hits.end(), [](const SearchHit &a, const SearchHit &b) {
+        return a.index < b.index || (a.index == b.index && a.offset < b.offset);
+    });
+
+    // the later entries may be matched before the earlier ones; the first match of the lowest one is kept
+    if (firstOnly && hits.size() > 1)
+        hits.resize(1);
+
+    return hits;
+}
+
+bool ZipReader::forEachEntry(const EntryFilter &filter, const EntryVisitor &visitor) const
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    mz_zip_archive *pZip = PZIP;
+    QByteArray scratch;                                 // grows up to the largest entry
+    QByteArray read_buf(MZ_ZIP_MAX_IO_BUF_SIZE, '\0');  // compressed data read from the file
+    bool res = true;
+
+    for (const EntryInfo &entry : entries()) {
+        if (filter && !filter(entry))
+            continue;
+
+        if (entry.isFolder) {
+            if (!visitor(entry, QByteArray()))
+                return false;
+            continue;
+        }
+
+        if (m_verbose)
+            std::cout << "Extracting: " << entry.rawName.constData();
+
+        const qint64 size = entry.sizeUncompressed;
+        bool extracted = false;
+
+        // the size comes from the archive: not trusted to allocate or to fit the int sizes of Qt 5
+        if (!fitsBuffer(size)) {
+            if (m_verbose)
+                std::cout << CH_SPACE << RESULT_FAILED << std::endl;
+            qWarning() << "QMicroz: File is too large for the buffer:" << entry.index << entry.name();
+            res = false;
+            continue;
+        }
+
+        if (scratch.size() < size)
+            scratch.resize(size);
+
+        {
+            TRACE_SPAN("inflate", entry.name());
+            StatsTimer timer(&QMicroz::Stats::inflateNs);
+            extracted = mz_zip_reader_extract_to_mem_no_alloc(pZip, entry.index,
+                                                              scratch.data(), scratch.size(), 0,
+                                                              read_buf.data(), read_buf.size());
+        }
+
+        if (m_verbose)
+            std::cout << CH_SPACE << (extracted ? RESULT_OK : RESULT_FAILED) << std::endl;
+
+        if (!extracted) {
+            res = false;
+            continue;
+        }
+
+        countEntry(entry.sizeCompressed, size);
+
+        if (!visitor(entry, QByteArray::fromRawData(scratch.constData(), size)))
+            return false;
+    }
+
+    return res;
+}
+
+
+Manifest ZipReader::forEachEntry(const EntryFilter &filter, const EntryVisitor &visitor,
+                                 const DigestList &algorithms) const
+{
+    Manifest manifest;
+    manifest.algorithms = algorithms;
+    FileDigester digester(algorithms);
+
+    auto digestingVisitor = [&](const EntryInfo &entry, const QByteArray &data) {
+        if (entry.isFile()) {
+            digester.reset();
+            digester.addData(data.constData(), data.size());
+
+            ManifestEntry file;
+            file.index = entry.index;
+            file.name = entry.name();
+            file.size = entry.sizeUncompressed;
+            file.crc32 = entry.crc32;
+            file.digests = digester.results();
+            manifest.files.append(file);
+        }
+
+        return visitor(entry, data);
+    }; // lambda digestingVisitor
+
+    manifest.success = forEachEntry(filter, digestingVisitor);
+    return manifest;
+}
+
+
+/*** ZipWriter ***/
+/* The background compression: the workers compress the tasks in any order,
+ * the writer thread adds them to the archive in the order of enqueueing.
+ */
+struct ZipWriter::Queue
+{
+    struct Task {
+        BufFile file;
+        QByteArray deflated; // raw deflate stream; empty to add the file as is
+        quint32 crc32 = 0;
+        bool done = false;   // compressed, ready to be written
+    };
+
+    int capacity = 0;
+    bool stopping = false;
+    bool failed = false;
+
+    std::mutex mutex;
+    std::condition_variable cond_pending; // a task is pending, or stopping
+    std::condition_variable cond_done;    // a task is compressed, or stopping
+    std::condition_variable cond_written; // a task is written: there is a free place
+
+    std::deque<std::shared_ptr<Task>> pending; // not taken by a worker yet
+    std::deque<std::shared_ptr<Task>> ordered; // not written yet, in the order of enqueueing
+
+    std::vector<std::thread> workers;
+    std::thread writer;
+};
+
+// The parts of a gzip member (RFC 1952)
+struct GzipMember {
+    QByteArray deflate;  // raw deflate stream; a view of the member data
+    quint32 crc32 = 0;
+    qint64 size = 0;     // uncompressed size modulo 2^32
+    qint64 modified = 0; // MTIME, seconds since epoch; 0 if not set
+};
+
+// Splits the single gzip member <data> into its parts
+static bool parseGzip(const QByteArray &data, GzipMember &member)
+{
+    enum Flags : quint8 { FHCRC = 0x02, FEXTRA = 0x04, FNAME = 0x08, FCOMMENT = 0x10 };
+    static const int header_size = 10;
+    static const int trailer_size = 8;
+
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+    const qint64 size = data.size();
+
+    // ID1, ID2, CM (8 is deflate)
+    if (size < header_size + trailer_size || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8)
+        return false;
+
+    const quint8 flags = p[3];
+    qint64 pos = header_size;
+
+    if (flags & FEXTRA) {
+        if (pos + 2 > size)
+            return false;
+        pos += 2 + qFromLittleEndian<quint16>(p + pos);
+    }
+
+    // zero-terminated strings
+    for (quint8 flag : { FNAME, FCOMMENT }) {
+        if (flags & flag) {
+            while (pos < size && p[pos] != 0)
+                ++pos;
+            ++pos;
+        }
+    }
+
+    if (flags & FHCRC)
+        pos += 2;
+
+    if (pos > size - trailer_size)
+        return false;
+
+    const uchar *trailer = p + size - trailer_size;
+    member.deflate = QByteArray::fromRawData(data.constData() + pos, size - trailer_size - pos);
+    member.crc32 = qFromLittleEndian<quint32>(trailer);
+    member.size = qFromLittleEndian<quint32>(trailer + 4);
+    member.modified = qFromLittleEndian<quint32>(p + 4);
+    return true;
+}
+
+// The compressor state of the thread, see QMicroz::compressorMemory
+static thread_local std::unique_ptr<tdefl_compressor, void (*)(tdefl_compressor *)>
+    t_compressor(nullptr, tdefl_compressor_free);
+
+// Returns the compressor state of the calling thread, allocated once per thread
+static tdefl_compressor* threadCompressor()
+{
+    if (!t_compressor)
+        t_compressor.reset(tdefl_compressor_alloc());
+
+    return t_compressor.get();
+}
+
+// Frees the compressor state of the calling thread: CompressorProfile::LowMemory
+static void releaseThreadCompressor()
+{
+    t_compressor.reset();
+}
+
+// Output of the <tdefl_compressor>: appends to the QByteArray
+static mz_bool appendToBuf(const void *pBuf, int len, void *pUser)
+{
+    static_cast<QByteArray *>(pUser)->append(static_cast<const char *>(pBuf), len);
+    return MZ_TRUE;
+}
+
+// Compresses the <data> into a raw deflate stream (no zlib header) on the calling thread
+static bool deflateRaw(const QByteArray &data, int level, QByteArray &out)
+{
+    tdefl_compressor *comp = threadCompressor();
+    const int flags = tdefl_create_comp_flags_from_zip_params(level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+
+    out.clear();
+    return comp
+           && tdefl_init(comp, appendToBuf, &out, flags) == TDEFL_STATUS_OKAY
+           && tdefl_compress_buffer(comp, data.constData(), data.size(), TDEFL_FINISH) == TDEFL_STATUS_DONE;
+}
+
+// Compresses the <file> contents into a raw deflate stream by chunks, calculating its <size> and CRC-32
+static bool deflateFile(QFile &file, int level, QByteArray &out, qint64 &size, quint32 &crc32)
+{
+    tdefl_compressor *comp = threadCompressor();
+    const int flags = tdefl_create_comp_flags_from_zip_params(level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+
+    out.clear();
+    size = 0;
+    crc32 = MZ_CRC32_INIT;
+
+    if (!comp || tdefl_init(comp, appendToBuf, &out, flags) != TDEFL_STATUS_OKAY)
+        return false;
+
+    QByteArray chunk(MZ_ZIP_MAX_IO_BUF_SIZE, Qt::Uninitialized);
+    tdefl_status status = TDEFL_STATUS_OKAY;
+
+    while (status == TDEFL_STATUS_OKAY) {
+        qint64 read = 0;
+
+        {
+            StatsTimer timer(&QMicroz::Stats::fileIoNs);
+            read = file.read(chunk.data(), chunk.size());
+        }
+
+        if (read < 0)
+            return false;
+
+        size += read;
+
+        {
+            StatsTimer timer(&QMicroz::Stats::crcNs);
+            crc32 = mz_crc32(crc32, reinterpret_cast<const mz_uint8 *>(chunk.constData()), read);
+        }
+
+        status = tdefl_compress_buffer(comp, chunk.constData(), read, read > 0 ? TDEFL_NO_FLUSH : TDEFL_FINISH);
+    }
+
+    return status == TDEFL_STATUS_DONE;
+}
+
+// The mutexes of the ZipWriter, kept out of the public header
+struct ZipWriter::Locks
+{
+    std::mutex write;
+    std::mutex queue;
+};
+
+ZipWriter::ZipWriter()
+    : m_locks(new Locks)
+{}
+
+ZipWriter::ZipWriter(const QString &zipPath)
+    : m_locks(new Locks)
+{
+    open(zipPath);
+}
+
+ZipWriter::ZipWriter(ZipWriter &&other) noexcept
+    : ZipArchive(withQueueStopped(other)),
+      m_entries(std::move(other.m_entries)),
+      m_concurrent(other.m_concurrent),
+      m_profile(other.m_profile),
+      m_alignment(other.m_alignment),
+      m_buffer(std::move(other.m_buffer)),
+      m_locks(new Locks)
+{}
+
+ZipWriter& ZipWriter::operator=(ZipWriter &&other) noexcept
+{
+    // the queue threads refer to the object
+    stopQueue();
+    other.stopQueue();
+
+    ZipArchive::operator=(std::move(other));
+    std::swap(m_entries, other.m_entries);
+    std::swap(m_concurrent, other.m_concurrent);
+    std::swap(m_profile, other.m_profile);
+    std::swap(m_alignment, other.m_alignment);
+    m_buffer.swap(other.m_buffer);
+    return *this;
+}
+
+ZipWriter::~ZipWriter()
+{
+    close();
+}
+
+bool ZipWriter::open(const QString &zipPath)
+{
+    // close the currently opened one if any
+    close();
+
+    mz_zip_archive *pZip = new mz_zip_archive();
+    QByteArray zipPathBytes = zipPath.toUtf8();
+    bool success = false;
+
+    {
+        TRACE_SPAN("open", zipPath);
+        success = mz_zip_writer_init_file(pZip, zipPathBytes.constData(), 0);
+    }
+
+    if (!success) {
+        qWarning() << "QMicroz: Failed to open zip file:" << zipPath;
+        delete pZip;
+        return false;
+    }
+
+    hookFileIo(pZip);
+    m_archive = pZip;
+    m_zip_path = zipPath;
+    m_buffer.reset();
+    return true;
+}
+
+bool ZipWriter::openBuffer(const QByteArray &bufferedZip, qint64 reserve)
+{
+    // close the currently opened one if any
+    close();
+
+    if (!bufferedZip.isEmpty() && !QMicroz::isArchive(bufferedZip)) {
+        qWarning() << "QMicroz: The byte array is not zipped";
+        return false;
+    }
+
+    // shares the data until the first write
+    std::unique_ptr<QByteArray> buffer(new QByteArray(bufferedZip));
+
+    if (reserve > buffer->size())
+        buffer->reserve(reserve);
+
+    mz_zip_archive *pZip = new mz_zip_archive();
+    pZip->m_pRead = readFromBuffer;
+    pZip->m_pWrite = writeToBuffer;
+    pZip->m_pIO_opaque = buffer.get();
+    bool success = false;
+
+    {
+        TRACE_SPAN("open");
+        StatsTimer timer(&QMicroz::Stats::indexNs);
+
+        // the existing archive is continued from its central directory
+        success = bufferedZip.isEmpty() ? mz_zip_writer_init_v2(pZip, 0, 0)
+                                        : (mz_zip_reader_init(pZip, bufferedZip.size(), 0)
+                                           && mz_zip_writer_init_from_reader(pZip, NULL));
+    }
+
+    if (!success) {
+        qWarning() << "QMicroz: Failed to open buffered zip for Writing";
+        mz_zip_end(pZip);
+        delete pZip;
+        return false;
+    }
+
+    // the existing entries can't be added again
+    const mz_uint count = mz_zip_reader_get_num_files(pZip);
+    QByteArray name;
+
+    for (mz_uint i = 0; i < count; ++i) {
+        name.resize(mz_zip_reader_get_filename(pZip, i, nullptr, 0));
+        mz_zip_reader_get_filename(pZip, i, name.data(), name.size());
+        m_entries[QString::fromUtf8(name.constData())] = i;
+    }
+
+    m_archive = pZip;
+    m_buffer = std::move(buffer);
+    return true;
+}
+
+bool ZipWriter::close()
+{
+    if (!m_archive)
+        return false;
+
+    // writes the rest of the queue if any
+    stopQueue();
+
+    mz_zip_archive *pZip = PZIP;
+    bool res = false;
+
+    {
+        TRACE_SPAN("write central directory", m_zip_path);
+        res = mz_zip_writer_finalize_archive(pZip);
+    }
+
+    // cuts the rest of the replaced central directory; keeps the capacity, so no copy
+    if (m_buffer)
+        m_buffer->resize(res ? pZip->m_archive_size : 0);
+
+    endArchive(pZip);
+    m_archive = nullptr;
+    m_entries.clear();
+    m_zip_path.clear();
+    return res;
+}
+
+QByteArray ZipWriter::takeBuffer()
+{
+    if (!m_buffer)
+        return QByteArray();
+
+    close();
+
+    QByteArray buffer = std::move(*m_buffer);
+    m_buffer.reset();
+    return buffer;
+}
+
+const ZipContents& ZipWriter::contents() const
+{
+    return m_entries;
+}
+
+bool ZipWriter::addEntry(const QString &entryName, std::function<bool()> addFunc)
+{
+    if (entryName.isEmpty())
+        return false;
+
+    // serializes the concurrent writes
+    std::lock_guard<std::mutex> lock(m_locks->write);
+
+    if (m_verbose)
+        std::cout << "Adding: " << entryName.toStdString();
+
+    if (m_entries.contains(entryName)) {
+        if (m_verbose)
+            std::cout << CH_SPACE << RESULT_EXISTS << std::endl;
+        return false;
+    }
+
+    if (!addFunc()) {
+        if (m_verbose)
+            std::cout << CH_SPACE << RESULT_FAILED << std::endl;
+        return false;
+    }
+
+    if (m_verbose)
+        std::cout << CH_SPACE << RESULT_OK << std::endl;
+
+    m_entries[entryName] = m_entries.size();
+    return true;
+}
+
+bool ZipWriter::addFile(const QString &sourcePath, const QString &entryName, bool store)
+{
+    mz_zip_archive *pZip = PZIP;
+    const int alignment = m_alignment;
+
+    // compressing on the calling thread, the writing is serialized; the low memory profile streams instead
+    if (m_concurrent && !store && m_profile != CompressorProfile::LowMemory) {
+        QFile file(sourcePath);
+
+        if (file.open(QFile::ReadOnly) && COMPLEVEL(file.size()) != MZ_NO_COMPRESSION) {
+            QByteArray deflated;
+            qint64 size = 0;
+            quint32 crc32 = 0;
+            bool res = false;
+
+            {
+                TRACE_SPAN("deflate", entryName);
+                StatsTimer timer(&QMicroz::Stats::deflateNs);
+                res = deflateFile(file, COMPLEVEL(file.size()), deflated, size, crc32);
+            }
+
+            return res && addCompressed(entryName, deflated, size, crc32, QFileInfo(sourcePath).lastModified());
+        }
+    }
+
+    std::function<bool()> func = [pZip, alignment, store, &sourcePath, &entryName]() {
+        QByteArray entryBytes = entryName.toUtf8();
+        QFile file(sourcePath);
+
+        if (!file.open(QFile::ReadOnly))
+            return false;
+
+        const qint64 size = file.size();
+        const int level = store ? MZ_NO_COMPRESSION : COMPLEVEL(size);
+        const QByteArray extra = (level == MZ_NO_COMPRESSION && size > 0)
+                                     ? alignmentExtra(pZip, entryBytes.size(), alignment) : QByteArray();
+        const mz_uint64 archive_size = pZip->m_archive_size;
+        MZ_TIME_T modified = QFileInfo(sourcePath).lastModified().toSecsSinceEpoch();
+        bool res = false;
+
+        {
+            TRACE_SPAN("deflate", entryName);
+            StatsTimer timer(&QMicroz::Stats::deflateNs);
+            res = mz_zip_writer_add_read_buf_callback(pZip,
+                                                      entryBytes.constData(), // entry name/path inside the zip
+                                                      readFromFile, &file,    // filesystem source
+                                                      size, &modified,
+                                                      NULL, 0,
+                                                      level,
+                                                      extra.constData(), extra.size(), // local extra: alignment
+                                                      NULL, 0);
+        }
+
+        if (res)
+            countEntry(size, pZip->m_archive_size - archive_size);
+
+        return res;
+    }; // lambda
+
+    return addEntry(entryName, func);
+}
+
+bool ZipWriter::addToZip(const QString &sourcePath, const QString &entryName)
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    if (entryName.isEmpty() || !QFileInfo::exists(sourcePath)) {
+        return false;
+    }
+
+    /* <entry> is a name or path of the folder inside the archive.
+     * <modified> its last modified date; invalid QDateTime() to set current.
+     */
+    auto addFolder = [this](const QString &entry, const QDateTime &modified) {
+        BufFile bf(toFolderName(entry), modified);
+        return this->addToZip(bf);
+    }; // lambda addFolder -> bool
+
+    QFileInfo fi_source(sourcePath);
+
+    if (fi_source.isFile()) {
+        return addFile(sourcePath, entryName);
+    } else if (fi_source.isDir()) {
+        // adding the folder entry itself
         bool added = addFolder(entryName, fi_source.lastModified());
 
-        // adding folder contents
-        QDir dir(sourcePath);
+        // adding folder contents
+        QDir dir(sourcePath);
+
+        QDirIterator it(sourcePath,
+                        QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::Hidden | QDir::Readable,
+                        QDirIterator::Subdirectories);
+
+        while (it.hasNext()) {
+            const QString fullPath = it.next();
+            const QString relPath = joinPath(entryName, dir.relativeFilePath(fullPath));
+            const QFileInfo &fi = it.fileInfo();
+
+            if ((fi.isFile() && addFile(fullPath, relPath))
+                || (fi.isDir() && addFolder(relPath, fi.lastModified())))
+            {
+                added = true;
+            }
+        }
+
+        return added;
+    }
+
+    return false;
+}
+
+bool ZipWriter::addToZip(const BufFile &bufFile)
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    // only the files worth compressing, the rest is cheap to write under the lock
+    if (m_concurrent && !isFolderName(bufFile.name) && COMPLEVEL(bufFile.data.size()) != MZ_NO_COMPRESSION)
+        return addConcurrently(bufFile);
+
+    return addBuf(bufFile, false);
+}
+
+bool ZipWriter::addBuf(const BufFile &bufFile, bool store)
+{
+    mz_zip_archive *pZip = PZIP;
+    const int alignment = m_alignment;
+
+    std::function<bool()> func = [pZip, alignment, store, &bufFile]() {
+        QByteArray entryNameBytes = bufFile.name.toUtf8();
+        const QByteArray &data = isFolderName(bufFile.name) ? QByteArray() : bufFile.data;
+        const int level = store ? MZ_NO_COMPRESSION : COMPLEVEL(data.size());
+        const QByteArray extra = (level == MZ_NO_COMPRESSION && !data.isEmpty())
+                                     ? alignmentExtra(pZip, entryNameBytes.size(), alignment) : QByteArray();
+        time_t modified = bufFile.modified.isValid() ? bufFile.modified.toSecsSinceEpoch() : 0;
+        const mz_uint64 archive_size = pZip->m_archive_size;
+        bool res = false;
+
+        {
+            TRACE_SPAN("deflate", bufFile.name);
+            StatsTimer timer(&QMicroz::Stats::deflateNs);
+            res = mz_zip_writer_add_mem_ex_v2(pZip,
+                                              entryNameBytes.constData(),          // entry name/path
+                                              data.constData(),                    // file data
+                                              data.size(),                         // file size
+                                              NULL, 0,
+                                              level,
+                                              0, 0,
+                                              modified > 0 ? &modified : NULL,     // last modified, NULL to set current time
+                                              extra.constData(), extra.size(),     // local extra: alignment
+                                              NULL, 0);
+        }
+
+        if (res)
+            countEntry(data.size(), pZip->m_archive_size - archive_size);
+
+        return res;
+    }; // lambda
+
+    return addEntry(bufFile.name, func);
+}
+
+bool ZipWriter::addStored(const BufFile &bufFile)
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    return addBuf(bufFile, true);
+}
+
+bool ZipWriter::addStored(const QString &sourcePath, const QString &entryName)
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    if (entryName.isEmpty() || !QFileInfo(sourcePath).isFile())
+        return false;
+
+    return addFile(sourcePath, entryName, true);
+}
+
+bool ZipWriter::setAlignment(int alignment)
+{
+    // a power of two the extra field can hold
+    if (alignment < 0 || alignment > 0x10000 || (alignment & (alignment - 1))) {
+        qWarning() << "QMicroz: Invalid alignment:" << alignment;
+        return false;
+    }
+
+    m_alignment = alignment;
+    return true;
+}
+
+bool ZipWriter::addToZip(const BufList &bufList)
+{
+    bool added = false;
+    BufList::const_iterator it;
+
+    for (it = bufList.constBegin(); it != bufList.constEnd(); ++it) {
+        if (addToZip(BufFile(it.key(), it.value())))
+            added = true;
+    }
+
+    return added;
+}
+
+bool ZipWriter::addToZip(BufList &&bufList)
+{
+    bool added = false;
+    BufList::iterator it;
+
+    for (it = bufList.begin(); it != bufList.end(); ++it) {
+        // takes the data, which is released when the <bufFile> goes out of scope
+        BufFile bufFile(it.key());
+        bufFile.data.swap(it.value());
+
+        if (addToZip(bufFile))
+            added = true;
+    }
+
+    bufList.clear();
+    return added;
+}
+
+bool ZipWriter::addToZip(const BufFileList &bufFiles)
+{
+    bool added = false;
+
+    for (const BufFile &bufFile : bufFiles) {
+        if (addToZip(bufFile))
+            added = true;
+    }
+
+    return added;
+}
+
+bool ZipWriter::addToZip(BufFileList &&bufFiles)
+{
+    bool added = false;
+
+    for (BufFile &item : bufFiles) {
+        // takes the data, which is released when the <bufFile> goes out of scope
+        const BufFile bufFile(std::move(item));
+
+        if (addToZip(bufFile))
+            added = true;
+    }
+
+    bufFiles.clear();
+    return added;
+}
+
+bool ZipWriter::addCompressed(const QString &entryName, const QByteArray &rawDeflate,
+                              qint64 size, quint32 crc32, const QDateTime &modified)
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    if (size < 0 || (size > 0 && rawDeflate.isEmpty())) {
+        qWarning() << "QMicroz: Invalid compressed data:" << entryName;
+        return false;
+    }
+
+    // empty files are stored, as by addToZip
+    if (size == 0) {
+        if (crc32 != 0) {
+            qWarning() << "QMicroz: Invalid compressed data:" << entryName;
+            return false;
+        }
+
+        return addBuf(BufFile(entryName, modified), true);
+    }
+
+    mz_zip_archive *pZip = PZIP;
+
+    std::function<bool()> func = [&]() {
+        QByteArray entryNameBytes = entryName.toUtf8();
+        time_t modified_sec = modified.isValid() ? modified.toSecsSinceEpoch() : 0;
+        const mz_uint64 archive_size = pZip->m_archive_size;
+        bool res = false;
+
+        {
+            TRACE_SPAN("write", entryName);
+            StatsTimer timer(&QMicroz::Stats::fileIoNs);
+            res = mz_zip_writer_add_mem_ex_v2(pZip,
+                                              entryNameBytes.constData(),
+                                              rawDeflate.constData(),
+                                              rawDeflate.size(),
+                                              NULL, 0,
+                                              MZ_ZIP_FLAG_COMPRESSED_DATA,
+                                              size, crc32,
+                                              modified_sec > 0 ? &modified_sec : NULL,
+                                              NULL, 0, NULL, 0);
+        }
+
+        if (res)
+            countEntry(size, pZip->m_archive_size - archive_size);
+
+        return res;
+    }; // lambda
+
+    return addEntry(entryName, func);
+}
+
+bool ZipWriter::addGzip(const QString &entryName, const QByteArray &gzipData, const QDateTime &modified)
+{
+    GzipMember member;
+    if (!parseGzip(gzipData, member)) {
+        qWarning() << "QMicroz: Not a gzip member:" << entryName;
+        return false;
+    }
+
+    QDateTime entry_modified = modified;
+    if (!entry_modified.isValid() && member.modified > 0)
+        entry_modified = QDateTime::fromSecsSinceEpoch(member.modified);
+
+    return addCompressed(entryName, member.deflate, member.size, member.crc32, entry_modified);
+}
+
+bool ZipWriter::addConcurrently(const BufFile &bufFile)
+{
+    QByteArray deflated;
+    quint32 crc32 = 0;
+    bool res = false;
+
+    {
+        TRACE_SPAN("deflate", bufFile.name);
+        StatsTimer timer(&QMicroz::Stats::deflateNs);
+
+        {
+            StatsTimer crc_timer(&QMicroz::Stats::crcNs);
+            crc32 = mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const mz_uint8 *>(bufFile.data.constData()), bufFile.data.size());
+        }
+
+        res = deflateRaw(bufFile.data, COMPLEVEL(bufFile.data.size()), deflated);
+    }
+
+    if (m_profile == CompressorProfile::LowMemory)
+        releaseThreadCompressor();
+
+    if (!res)
+        return false;
+
+    return addCompressed(bufFile.name, deflated, bufFile.data.size(), crc32, bufFile.modified);
+}
+
+
+void ZipWriter::setConcurrent(bool enable)
+{
+    m_concurrent = enable;
+}
+
+void ZipWriter::setCompressorProfile(CompressorProfile profile)
+{
+    m_profile = profile;
+}
+
+bool ZipWriter::startQueue(int capacity, int threads)
+{
+    if (!isOpen()) {
+        qWarning() << WARNING_ZIPNOTSET;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> queue_lock(m_locks->queue);
+
+    if (m_queue)
+        return true;
+
+    if (threads <= 0)
+        threads = qMax(1, QThread::idealThreadCount());
+
+    m_queue = std::make_shared<Queue>();
+    m_queue->capacity = qMax(1, capacity);
+
+    Queue *queue = m_queue.get();
+    const bool low_memory = m_profile == CompressorProfile::LowMemory;
+
+    auto worker = [queue, low_memory]() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->cond_pending.wait(lock, [queue] { return queue->stopping || !queue->pending.empty(); });
+
+            if (queue->pending.empty())
+                break; // stopping
+
+            std::shared_ptr<Queue::Task> task = queue->pending.front();
+            queue->pending.pop_front();
+            lock.unlock();
+
+            const BufFile &file = task->file;
+            const int level = isFolderName(file.name) ? MZ_NO_COMPRESSION : COMPLEVEL(file.data.size());
+
+            if (level != MZ_NO_COMPRESSION) {
+                TRACE_SPAN("deflate", file.name);
+                StatsTimer timer(&QMicroz::Stats::deflateNs);
+                {
+                    StatsTimer crc_timer(&QMicroz::Stats::crcNs);
+                    task->crc32 = mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const mz_uint8 *>(file.data.constData()), file.data.size());
+                }
+
+                if (!deflateRaw(file.data, level, task->deflated))
+                    task->deflated.clear(); // will be compressed by the writer
+
+                if (low_memory)
+                    releaseThreadCompressor();
+            }
+
+            lock.lock();
+            task->done = true;
+            queue->cond_done.notify_all();
+        }
+    }; // lambda worker
+
+    auto writer = [this, queue]() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->cond_done.wait(lock, [queue] {
+                return (!queue->ordered.empty() && queue->ordered.front()->done)
+                       || (queue->stopping && queue->ordered.empty());
+            });
+
+            if (queue->ordered.empty())
+                break; // stopping
+
+            std::shared_ptr<Queue::Task> task = queue->ordered.front();
+            lock.unlock();
+
+            const bool res = task->deflated.isEmpty() ? addToZip(task->file)
+                                                      : addCompressed(task->file.name, task->deflated,
+                                                                    task->file.data.size(), task->crc32,
+                                                                    task->file.modified);
+            task.reset(); // releases the data
+
+            lock.lock();
+            queue->ordered.pop_front();
+            if (!res)
+                queue->failed = true;
+            queue->cond_written.notify_all();
+        }
+    }; // lambda writer
+
+    for (int i = 0; i < threads; ++i) {
+        m_queue->workers.emplace_back(worker);
+    }
+
+    m_queue->writer = std::thread(writer);
+    return true;
+}
+
+ZipWriter&& ZipWriter::withQueueStopped(ZipWriter &writer)
+{
+    writer.stopQueue();
+    return std::move(writer);
+}
+
+std::shared_ptr<ZipWriter::Queue> ZipWriter::currentQueue() const
+{
+    std::lock_guard<std::mutex> lock(m_locks->queue);
+    return m_queue;
+}
+
+bool ZipWriter::enqueue(BufFile bufFile, bool blockIfFull)
+{
+    // kept alive while waiting, even if the queue is stopped meanwhile
+    const std::shared_ptr<Queue> shared_queue = currentQueue();
+    Queue *queue = shared_queue.get();
+
+    if (!queue) {
+        qWarning() << "QMicroz: The queue is not started.";
+        return false;
+    }
+
+    std::shared_ptr<Queue::Task> task(new Queue::Task);
+    task->file = std::move(bufFile);
+
+    std::unique_lock<std::mutex> lock(queue->mutex);
+
+    auto hasPlace = [queue] { return queue->stopping || int(queue->ordered.size()) < queue->capacity; };
+
+    if (!hasPlace()) {
+        if (!blockIfFull)
+            return false;
+
+        queue->cond_written.wait(lock, hasPlace);
+    }
+
+    if (queue->stopping)
+        return false;
+
+    queue->pending.push_back(task);
+    queue->ordered.push_back(task);
+    queue->cond_pending.notify_one();
+    return true;
+}
+
+bool ZipWriter::waitForQueue()
+{
+    const std::shared_ptr<Queue> shared_queue = currentQueue();
+    Queue *queue = shared_queue.get();
+
+    if (!queue)
+        return true;
+
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    queue->cond_written.wait(lock, [queue] { return queue->ordered.empty(); });
+
+    const bool res = !queue->failed;
+    queue->failed = false;
+    return res;
+}
+
+bool ZipWriter::stopQueue()
+{
+    // the waiting producers keep their references, and leave once woken
+    std::shared_ptr<Queue> queue;
+
+    {
+        std::lock_guard<std::mutex> lock(m_locks->queue);
+        queue.swap(m_queue);
+    }
+
+    if (!queue)
+        return true;
+
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->stopping = true;
+    }
+
+    queue->cond_pending.notify_all();
+    queue->cond_done.notify_all();
+    queue->cond_written.notify_all();
+
+    for (std::thread &worker : queue->workers) {
+        worker.join();
+    }
+
+    queue->writer.join();
+
+    return !queue->failed;
+}
+
+
+/*** QMicroz ***/
+QMicroz::QMicroz(QObject *parent)
+    : QObject(parent) {}
+
+QMicroz::QMicroz(const char* zipPath, QObject *parent)
+    : QObject(parent)
+{
+    setZipFile(QString(zipPath));
+}
+
+QMicroz::QMicroz(const QString &zipPath, QObject *parent)
+    : QObject(parent)
+{
+    setZipFile(zipPath);
+}
+
+QMicroz::QMicroz(const QString &zipPath, Mode mode, QObject *parent)
+    : QObject(parent)
+{
+    setZipFile(zipPath, mode);
+}
+
+QMicroz::QMicroz(const QByteArray &bufferedZip, QObject *parent)
+    : QObject(parent)
+{
+    setZipBuffer(bufferedZip);
+}
+
+QMicroz::~QMicroz()
+{
+    closeArchive();
+}
+
+const ZipArchive& QMicroz::archive() const
+{
+    if (m_writer)
+        return m_writer;
+
+    return m_reader;
+}
+
+bool QMicroz::isModeReading() const
+{
+    return m_reader.isOpen();
+}
+
+bool QMicroz::isModeWriting() const
+{
+    return m_writer.isOpen();
+}
+
+void QMicroz::setVerbose(bool enable)
+{
+    m_reader.setVerbose(enable);
+    m_writer.setVerbose(enable);
+}
+
+bool QMicroz::setZipFile(const QString &zipPath, Mode mode)
+{
+    // close the currently opened one if any
+    closeArchive();
+
+    Mode zamode = ModeAuto; // 0
+
+    switch (mode) {
+    case ModeAuto:
+        if (!QFileInfo::exists(zipPath))
+            zamode = ModeWrite;
+        else if (isZipFile(zipPath))
+            zamode = ModeRead;
+        break;
+    case ModeRead:
+        if (isZipFile(zipPath))
+            zamode = ModeRead;
+        break;
+    case ModeWrite:
+        zamode = ModeWrite;
+        break;
+    default:
+        break;
+    }
+
+    if (zamode == 0) {
+        qWarning() << WARNING_WRONGPATH << zipPath;
+        return false;
+    }
+
+    // Here the <zamode> can be either ModeRead or ModeWrite
+    if (zamode == ModeWrite)
+        return m_writer.open(zipPath);
+
+    if (!m_reader.open(zipPath))
+        return false;
+
+    setOutputFolder(); // zip file's parent folder
+    return true;
+}
+
+std::unique_ptr<QMicroz> QMicroz::openNested(int index) const
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return nullptr;
+    }
+
+    ZipReader reader = m_reader.openNested(index);
+
+    if (!reader.isOpen())
+        return nullptr;
+
+    std::unique_ptr<QMicroz> nested(new QMicroz());
+    nested->m_reader = std::move(reader);
+    return nested;
+}
+
+bool QMicroz::setZipBuffer(const QByteArray &bufferedZip, Mode mode)
+{
+    if (mode != ModeWrite)
+        return setZipBuffer(bufferedZip);
+
+    if (!m_writer.openBuffer(bufferedZip))
+        return false;
+
+    // close the reader if any
+    m_reader.close();
+    m_output_folder.clear();
+    return true;
+}
+
+QByteArray QMicroz::takeBuffer()
+{
+    return m_writer.takeBuffer();
+}
+
+bool QMicroz::setZipBuffer(const QByteArray &bufferedZip)
+{
+    // the reader keeps the currently opened archive on failure
+    if (!m_reader.openBuffer(bufferedZip))
+        return false;
+
+    // close the writer if any
+    m_writer.close();
+    m_output_folder.clear();
+    return true;
+}
+
+void QMicroz::setOutputFolder(const QString &outputFolder)
+{
+    if (outputFolder.isEmpty() && !zipFilePath().isEmpty()) {
+        // set zip file's parent folder
+        m_output_folder = QFileInfo(zipFilePath()).absolutePath();
+        return;
+    }
+
+    m_output_folder = outputFolder;
+}
+
+const QString& QMicroz::outputFolder() const
+{
+    if (m_output_folder.isEmpty())
+        qWarning() << "QMicroz: No output folder.";
+
+    return m_output_folder;
+}
+
+void QMicroz::closeArchive()
+{
+    m_reader.close();
+    m_writer.close();
+    m_output_folder.clear();
+}
+
+qint64 QMicroz::sizeCompressed() const
+{
+    return archive().sizeCompressed();
+}
+
+qint64 QMicroz::sizeUncompressed() const
+{
+    return archive().sizeUncompressed();
+}
+
+const QString& QMicroz::zipFilePath() const
+{
+    return archive().zipFilePath();
+}
+
+const ZipContents& QMicroz::contents()
+{
+    return isModeWriting() ? m_writer.contents() : m_reader.contents();
+}
+
+int QMicroz::count() const
+{
+    return archive().count();
+}
+
+int QMicroz::findIndex(const QString &fileName)
+{
+    return isModeWriting() ? findInContents(m_writer.contents(), fileName)
+                           : m_reader.findIndex(fileName);
+}
+
+bool QMicroz::isFolder(int index) const
+{
+    return archive().isFolder(index);
+}
+
+bool QMicroz::isFile(int index) const
+{
+    return archive().isFile(index);
+}
+
+QString QMicroz::name(int index) const
+{
+    return archive().name(index);
+}
+
+qint64 QMicroz::sizeCompressed(int index) const
+{
+    return archive().sizeCompressed(index);
+}
+
+qint64 QMicroz::sizeUncompressed(int index) const
+{
+    return archive().sizeUncompressed(index);
+}
+
+QDateTime QMicroz::lastModified(int index) const
+{
+    return archive().lastModified(index);
+}
+
+EntryInfo QMicroz::entryInfo(int index) const
+{
+    return archive().entryInfo(index);
+}
+
+ZipArchive::Entries QMicroz::entries() const
+{
+    return archive().entries();
+}
+
+bool QMicroz::addToZip(const QString &sourcePath)
+{
+    return addToZip(sourcePath, QFileInfo(sourcePath).fileName());
+}
+
+bool QMicroz::addToZip(const QString &sourcePath, const QString &entryName)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addToZip(sourcePath, entryName);
+}
+
+bool QMicroz::addToZip(const BufFile &bufFile)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addToZip(bufFile);
+}
+
+bool QMicroz::addToZip(const BufList &bufList)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addToZip(bufList);
+}
+
+bool QMicroz::addToZip(BufList &&bufList)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addToZip(std::move(bufList));
+}
+
+bool QMicroz::addToZip(const BufFileList &bufFiles)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addToZip(bufFiles);
+}
+
+bool QMicroz::addToZip(BufFileList &&bufFiles)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addToZip(std::move(bufFiles));
+}
+
+bool QMicroz::addCompressed(const QString &entryName, const QByteArray &rawDeflate,
+                            qint64 size, quint32 crc32, const QDateTime &modified)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addCompressed(entryName, rawDeflate, size, crc32, modified);
+}
+
+bool QMicroz::addGzip(const QString &entryName, const QByteArray &gzipData, const QDateTime &modified)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addGzip(entryName, gzipData, modified);
+}
+
+bool QMicroz::addStored(const BufFile &bufFile)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addStored(bufFile);
+}
+
+bool QMicroz::addStored(const QString &sourcePath, const QString &entryName)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.addStored(sourcePath, entryName);
+}
+
+bool QMicroz::setAlignment(int alignment)
+{
+    return m_writer.setAlignment(alignment);
+}
+
+void QMicroz::setConcurrent(bool enable)
+{
+    m_writer.setConcurrent(enable);
+}
+
+void QMicroz::setCompressorProfile(CompressorProfile profile)
+{
+    m_writer.setCompressorProfile(profile);
+}
+
+qint64 QMicroz::compressorMemory()
+{
+    return sizeof(tdefl_compressor);
+}
+
+bool QMicroz::startQueue(int capacity, int threads)
+{
+    if (!isModeWriting()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_writer.startQueue(capacity, threads);
+}
+
+bool QMicroz::enqueue(BufFile bufFile, bool blockIfFull)
+{
+    return m_writer.enqueue(std::move(bufFile), blockIfFull);
+}
+
+bool QMicroz::waitForQueue()
+{
+    return m_writer.waitForQueue();
+}
+
+bool QMicroz::extractAll()
+{
+    return m_reader.extractAll(outputFolder());
+}
+
+Manifest QMicroz::extractAll(const DigestList &algorithms, int threads)
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return Manifest();
+    }
+
+    return m_reader.extractAll(outputFolder(), algorithms, threads);
+}
+
+ArchiveDiff QMicroz::diff(const QString &zip_a, const QString &zip_b, bool verifyContent)
+{
+    TRACE_SPAN("diff", zip_a);
+
+    const ZipReader reader_a(zip_a);
+    const ZipReader reader_b(zip_b);
+
+    if (!reader_a || !reader_b)
+        return ArchiveDiff();
+
+    return reader_a.diff(reader_b, verifyContent);
+}
+
+bool QMicroz::updateAll(bool verifyCrc)
+{
+    return m_reader.updateAll(outputFolder(), verifyCrc);
+}
+
+bool QMicroz::extractIndex(int index)
+{
+    return m_reader.extractToFolder(index, outputFolder());
+}
+
+bool QMicroz::extractIndex(int index, const QString &outputPath)
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
+    }
+
+    return m_reader.extractIndex(index, outputPath);
+}
+
+bool QMicroz::extractFile(const QString &fileName)
+{
+    return extractIndex(findIndex(fileName));
+}
+
+bool QMicroz::extractFile(const QString &fileName, const QString &outputPath)
+{
+    return extractIndex(findIndex(fileName), outputPath);
+}
+
+bool QMicroz::extractFolder(const QString &folderName)
+{
+    if (outputFolder().isEmpty())
+        return false;
+
+    return extractFolder(folderName, joinPath(outputFolder(), folderName));
+}
+
+bool QMicroz::extractFolder(const QString &folderName, const QString &outputPath)
+{
+    return m_reader.extractFolder(folderName, outputPath);
+}
+
+Manifest QMicroz::extractFolder(const QString &folderName, const QString &outputPath,
+                               const DigestList &algorithms, int threads)
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return Manifest();
+    }
+
+    return m_reader.extractFolder(folderName, outputPath, algorithms, threads);
+}
+
+BufList QMicroz::extractToBuf()
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return BufList();
+    }
+
+    return m_reader.extractToBuf();
+}
+
+BufFile QMicroz::extractToBuf(int index) const
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return BufFile();
+    }
+
+    return m_reader.extractToBuf(index);
+}
+
+BufFile QMicroz::extractFileToBuf(const QString &fileName)
+{
+    return extractToBuf(findIndex(fileName));
+}
+
+BoundedBufList QMicroz::extractToBufBounded(qint64 memoryBudget, const QString &spillFolder) const
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return BoundedBufList();
+    }
+
+    return m_reader.extractToBufBounded(memoryBudget, spillFolder);
+}
+
+QByteArray QMicroz::extractData(int index) const
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return QByteArray();
+    }
+
+    return m_reader.extractData(index);
+}
 
-        QDirIterator it(sourcePath,
-                        QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::Hidden | QDir::Readable,
-                        QDirIterator::Subdirectories);
+QByteArray QMicroz::extractDataRef(int index) const
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return QByteArray();
+    }
 
-        while (it.hasNext()) {
-            const QString fullPath = it.next();
-            const QString relPath = joinPath(entryName, dir.relativeFilePath(fullPath));
-            const QFileInfo &fi = it.fileInfo();
+    return m_reader.extractDataRef(index);
+}
 
-            if ((fi.isFile() && addFile(fullPath, relPath))
-                || (fi.isDir() && addFolder(relPath, fi.lastModified())))
-            {
-                added = true;
-            }
-        }
 
-        return added;
+bool QMicroz::extractToFd(int index, int fd) const
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
     }
 
-    return false;
+    return m_reader.extractToFd(index, fd);
 }
 
-bool QMicroz::addToZip(const BufFile &bufFile)
+RawEntry QMicroz::extractRaw(int index) const
 {
-    if (!isModeWriting()) {
+    if (!isModeReading()) {
         qWarning() << WARNING_WRONGMODE;
-        return false;
+        return RawEntry();
     }
 
-    mz_zip_archive *pZip = PZIP;
+    return m_reader.extractRaw(index);
+}
 
-    std::function<bool()> func = [pZip, &bufFile]() {
-        QByteArray entryNameBytes = bufFile.name.toUtf8();
-        const QByteArray &data = isFolderName(bufFile.name) ? QByteArray() : bufFile.data;
-        time_t modified = bufFile.modified.isValid() ? bufFile.modified.toSecsSinceEpoch() : 0;
+QVector<SearchHit> QMicroz::search(const QByteArray &pattern, const EntryFilter &filter,
+                                   int threads, bool firstOnly) const
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return QVector<SearchHit>();
+    }
 
-        return mz_zip_writer_add_mem_ex_v2(pZip,
-                                           entryNameBytes.constData(),          // entry name/path
-                                           data.constData(),                    // file data
-                                           data.size(),                         // file size
-                                           NULL, 0,
-                                           COMPLEVEL(data.size()),
-                                           0, 0,
-                                           modified > 0 ? &modified : NULL,     // last modified, NULL to set current time
-                                           NULL, 0, NULL, 0);
-    }; // lambda
+    return m_reader.search(pattern, filter, threads, firstOnly);
+}
 
-    return addEntry(bufFile.name, func);
+qint64 QMicroz::dataOffset(int index) const
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return -1;
+    }
+
+    return m_reader.dataOffset(index);
 }
 
-bool QMicroz::addToZip(const BufList &bufList)
+QByteArray QMicroz::mapStored(int index) const
 {
-    bool added = false;
-    BufList::const_iterator it;
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return QByteArray();
+    }
 
-    for (it = bufList.constBegin(); it != bufList.constEnd(); ++it) {
-        if (addToZip(BufFile(it.key(), it.value())))
-            added = true;
+    return m_reader.mapStored(index);
+}
+
+bool QMicroz::forEachEntry(const EntryFilter &filter, const EntryVisitor &visitor) const
+{
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return false;
     }
 
-    return added;
+    return m_reader.forEachEntry(filter, visitor);
 }
 
-bool QMicroz::extractAll()
+Manifest QMicroz::forEachEntry(const EntryFilter &filter, const EntryVisitor &visitor,
+                               const DigestList &algorithms) const
 {
-    int num = 0;
+    if (!isModeReading()) {
+        qWarning() << WARNING_WRONGMODE;
+        return Manifest();
+    }
 
-    for (int i = 0; i < count(); ++i) {
-        if (extractIndex(i))
-            ++num;
+    return m_reader.forEachEntry(filter, visitor, algorithms);
+}
+
+/*** STATIC functions ***/
+bool QMicroz::extract(const QString &zip_path)
+{
+    // extract to parent folder
+    return extract(zip_path, QFileInfo(zip_path).absolutePath());
+}
+
+bool QMicroz::extract(const QString &zip_path, const QString &output_folder)
+{
+    ZipReader reader(zip_path);
+
+    return reader && reader.extractAll(output_folder);
+}
+
+/*** Compress ***/
+bool QMicroz::compress(const QString &path)
+{
+    QFileInfo fi(path);
+
+    if (!fi.isFile() && !fi.isDir()) {
+        qWarning() << WARNING_WRONGPATH << path;
+        return false;
     }
 
-    return num > 0 && num == count();
+    const QString base_name = fi.isFile() ? fi.completeBaseName() : fi.fileName();
+    const QString zip_name = base_name + s_zip_ext;
+    const QString zip_path = joinPath(fi.absolutePath(), zip_name);
+
+    return compress(path, zip_path);
 }
 
-bool QMicroz::extractIndex(int index)
+bool QMicroz::compress(const QStringList &paths)
 {
-    if (outputFolder().isEmpty())
+    if (paths.isEmpty())
         return false;
 
-    const QString outputPath = joinPath(outputFolder(), name(index));
+    const QString root_folder = QFileInfo(paths.first()).absolutePath();
+    const QString zip_name = QFileInfo(root_folder).fileName() + s_zip_ext;
+    const QString zip_path = joinPath(root_folder, zip_name);
 
-#if defined(CHECK_PATH_TRAVERSAL)
-    const QString canonical = QFileInfo(outputPath).absolutePath();
+    return compress(paths, zip_path);
+}
 
-    // Protection against placing a file outside the output folder.
-    // E.g. "../../file" entry inside the archive.
-    if (!canonical.startsWith(outputFolder())) {
-        qWarning() << "QMicroz: Path traversal attempt blocked:" << name(index);
+bool QMicroz::compress(const QString &source_path, const QString &zip_path)
+{
+    if (!QFileInfo::exists(source_path)) {
+        qWarning() << WARNING_WRONGPATH << source_path;
         return false;
     }
-#endif
 
-    return extractIndex(index, outputPath);
+    ZipWriter writer(zip_path);
+
+    return writer && writer.addToZip(source_path, QFileInfo(source_path).fileName());
 }
 
-bool QMicroz::extractIndex(int index, const QString &outputPath)
+bool QMicroz::compress(const QStringList &paths, const QString &zip_path)
 {
-    if (!isModeReading()) {
-        qWarning() << WARNING_WRONGMODE;
+    if (paths.isEmpty()) {
+        qWarning() << WARNING_NOINPUTDATA;
         return false;
     }
 
-    if (index == -1)
+    /* At the moment we consider the parent folder of the first item in the list as the relative Root.
+     * Archive entries are created relative to this root.
+     * Paths from the list which do not have a common root are placed at the archive's root.
+     *
+     * TODO: a smarter function for parsing paths and building internal entries based on multiple roots is needed.
+     */
+    const QString root = QFileInfo(paths.first()).absolutePath();
+    QDir dir(root);
+
+    ZipWriter writer(zip_path);
+    if (!writer)
         return false;
 
-    // the name is also a path inside the archive
-    const QString filename = name(index);
-    if (filename.isEmpty())
+    // process
+    for (const QString &path : paths) {
+        QString relPath = path.startsWith(root) ? dir.relativeFilePath(path)
+                                                : QFileInfo(path).fileName();
+
+        if (!writer.addToZip(path, relPath))
+            qWarning() << "QMicroz: Unable to add:" << path;
+    }
+
+    return writer.count() > 0;
+}
+
+bool QMicroz::compress(const BufList &buf_list, const QString &zip_path)
+{
+    if (buf_list.isEmpty()) {
+        qWarning() << WARNING_NOINPUTDATA;
         return false;
+    }
 
-    auto createFolder = [](const QString &path) {
-        if (QFileInfo::exists(path) || QDir().mkpath(path))
-            return true;
+    ZipWriter writer(zip_path);
 
-        qWarning() << "QMicroz: Failed to create directory:" << path;
+    return writer && writer.addToZip(buf_list);
+}
+
+bool QMicroz::compress(BufList &&buf_list, const QString &zip_path)
+{
+    if (buf_list.isEmpty()) {
+        qWarning() << WARNING_NOINPUTDATA;
         return false;
-    }; // lambda createFolder -> bool
+    }
 
-    if (isFileName(filename)) {
-        if (m_verbose)
-            std::cout << "Extracting: " << filename.toStdString();
+    ZipWriter writer(zip_path);
 
-        const QString parent_folder = QFileInfo(outputPath).absolutePath();
+    return writer && writer.addToZip(std::move(buf_list));
+}
 
-        // create parent folder on disk if not any
-        if (!createFolder(parent_folder))
-            return false;
+bool QMicroz::compress(const BufFileList &buf_files, const QString &zip_path)
+{
+    if (buf_files.isEmpty()) {
+        qWarning() << WARNING_NOINPUTDATA;
+        return false;
+    }
 
-        // extracting...
-        QByteArray outputPathBytes = outputPath.toUtf8();
-        bool res = mz_zip_reader_extract_to_file(PZIP, index, outputPathBytes.constData(), 0);
+    ZipWriter writer(zip_path);
 
-        if (m_verbose) {
-            std::cout << CH_SPACE << (res ? RESULT_OK : RESULT_FAILED) << std::endl;
-        } else if (!res) {
-            qWarning() << "QMicroz: Failed to extract file:" << index << filename;
-        }
+    return writer && writer.addToZip(buf_files);
+}
 
-        return res;
+bool QMicroz::compress(BufFileList &&buf_files, const QString &zip_path)
+{
+    if (buf_files.isEmpty()) {
+        qWarning() << WARNING_NOINPUTDATA;
+        return false;
     }
 
-    // <filename> is a folder entry
-    return createFolder(outputPath);
+    ZipWriter writer(zip_path);
+
+    return writer && writer.addToZip(std::move(buf_files));
 }
 
-bool QMicroz::extractFile(const QString &fileName)
+// Size of the end of central directory record
+static constexpr int s_eocd_size = 22;
+
+// Returns the expected size of the <name> entry with the <size> bytes of data in the archive
+static qint64 estimateEntrySize(const QString &name, qint64 size)
 {
-    return extractIndex(findIndex(fileName));
+    static const int headers_size = 30 + 46; // local and central directory headers
+
+    if (isFolderName(name))
+        size = 0;
+
+    // stored as is, or deflated up to the bound
+    const qint64 data_size = COMPLEVEL(size) == MZ_NO_COMPRESSION ? size : (qint64)mz_deflateBound(NULL, size);
+
+    // names are mostly ASCII; the output grows if not
+    return headers_size + 2 * name.size() + data_size;
 }
 
-bool QMicroz::extractFile(const QString &fileName, const QString &outputPath)
+QByteArray QMicroz::compressToBuf(const BufList &buf_list)
 {
-    return extractIndex(findIndex(fileName), outputPath);
+    if (buf_list.isEmpty()) {
+        qWarning() << WARNING_NOINPUTDATA;
+        return QByteArray();
+    }
+
+    qint64 estimate = s_eocd_size;
+
+    for (auto it = buf_list.constBegin(); it != buf_list.constEnd(); ++it) {
+        estimate += estimateEntrySize(it.key(), it.value().size());
+    }
+
+    ZipWriter writer;
+
+    if (!writer.openBuffer(QByteArray(), estimate) || !writer.addToZip(buf_list))
+        return QByteArray();
+
+    return writer.takeBuffer();
 }
 
-bool QMicroz::extractFolder(const QString &folderName)
+QByteArray QMicroz::compressToBuf(const BufFileList &buf_files)
 {
-    if (outputFolder().isEmpty())
+    if (buf_files.isEmpty()) {
+        qWarning() << WARNING_NOINPUTDATA;
+        return QByteArray();
+    }
+
+    qint64 estimate = s_eocd_size;
+
+    for (const BufFile &buf_file : buf_files) {
+        estimate += estimateEntrySize(buf_file.name, buf_file.data.size());
+    }
+
+    ZipWriter writer;
+
+    if (!writer.openBuffer(QByteArray(), estimate) || !writer.addToZip(buf_files))
+        return QByteArray();
+
+    return writer.takeBuffer();
+}
+
+bool QMicroz::compress(const BufFile &buf_file, const QString &zip_path)
+{
+    if (!buf_file) {
+        qWarning() << WARNING_NOINPUTDATA;
         return false;
+    }
 
-    return extractFolder(folderName, joinPath(outputFolder(), folderName));
+    ZipWriter writer(zip_path);
+
+    return writer && writer.addToZip(buf_file);
 }
 
-bool QMicroz::extractFolder(const QString &folderName, const QString &outputPath)
+bool QMicroz::compress(const QString &file_name,
+                       const QByteArray &file_data,
+                       const QString &zip_path)
 {
-    bool extracted = false;
-    QString folder_entry = toFolderName(folderName);
-    const ZipContents &entries = contents();
-    ZipContents::const_iterator it = entries.constBegin();
+    BufFile buf_file(file_name, file_data);
+
+    return compress(buf_file, zip_path);
+}
+
+// An entry of the input archive re-evaluated by QMicroz::optimize
+struct OptimizedEntry {
+    enum Action { Recompressed, Stored, Copied };
+
+    EntryInfo info;
+    QByteArray data;          // raw deflate stream, or the data to store
+    bool deflated = false;
+    Action action = Copied;
+    bool success = false;
+};
+
+// Reads the entry with <index> and chooses the smallest way to write it
+static OptimizedEntry optimizeEntry(const ZipReader &reader, int index, const OptimizePolicy &policy)
+{
+    OptimizedEntry entry;
+    entry.info = reader.entryInfo(index);
+
+    if (entry.info.isFolder) {
+        entry.success = entry.info.index >= 0;
+        return entry;
+    }
+
+    const RawEntry raw = reader.extractRaw(index);
+    const qint64 size = entry.info.sizeUncompressed;
 
-    for (; it != entries.constEnd(); ++it) {
-        if (it.key().startsWith(folder_entry)) {
-            // e.g. "folder_entry/file" --> "file"
-            QString relPath = it.key().mid(folder_entry.size());
+    if (!raw || (raw.method != RawEntry::Stored && raw.method != RawEntry::Deflated) || !fitsBuffer(size))
+        return entry;
 
-            if (extractIndex(it.value(), joinPath(outputPath, relPath)))
-                extracted = true;
-        }
+    // the raw stream is read once, and inflated from memory
+    QByteArray data;
+    if (raw.method == RawEntry::Stored) {
+        data = raw.data;
+    } else if (size > 0) {
+        TRACE_SPAN("inflate", entry.info.name());
+        StatsTimer timer(&QMicroz::Stats::inflateNs);
+        data = QByteArray(int(size), Qt::Uninitialized);
+
+        // fails if the stream gives more than the declared size
+        const size_t inflated = tinfl_decompress_mem_to_mem(data.data(), data.size(), raw.data.constData(), raw.data.size(), 0);
+        if (inflated == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED)
+            return entry;
+
+        data.resize(int(inflated));
     }
 
-    return extracted;
-}
+    if (data.size() != size)
+        return entry;
 
-BufList QMicroz::extractToBuf()
-{
-    if (!isModeReading()) {
-        qWarning() << WARNING_WRONGMODE;
-        return BufList();
+    {
+        StatsTimer timer(&QMicroz::Stats::crcNs);
+        if (crc32Fast(MZ_CRC32_INIT, reinterpret_cast<const uchar *>(data.constData()), data.size()) != entry.info.crc32)
+            return entry;
     }
 
-    BufList res;
-    const ZipContents &entries = contents();
+    // the best deflate stream: the new one or the existing
+    QByteArray deflated;
+    if (!data.isEmpty()) {
+        TRACE_SPAN("deflate", entry.info.name());
+        StatsTimer timer(&QMicroz::Stats::deflateNs);
+        if (!deflateRaw(data, policy.level, deflated))
+            return entry;
+    }
 
-    // extracting...
-    ZipContents::const_iterator it = entries.constBegin();
-    for (; it != entries.constEnd(); ++it) {
-        res[it.key()] = extractData(it.value());
+    const bool keep_raw = raw.method == RawEntry::Deflated && raw.data.size() <= deflated.size();
+    const qint64 best_size = keep_raw ? raw.data.size() : deflated.size();
+
+    if (data.isEmpty() || best_size > data.size() * (1.0 - policy.minSaving)) {
+        entry.data = data;
+        entry.action = raw.method == RawEntry::Stored ? OptimizedEntry::Copied : OptimizedEntry::Stored;
+    } else {
+        entry.data = keep_raw ? raw.data : deflated;
+        entry.deflated = true;
+        entry.action = keep_raw ? OptimizedEntry::Copied : OptimizedEntry::Recompressed;
     }
 
-    return res;
+    entry.success = true;
+    return entry;
 }
 
-BufFile QMicroz::extractToBuf(int index) const
+OptimizeReport QMicroz::optimize(const QString &input_zip, const QString &output_zip,
+                                 const OptimizePolicy &policy, int threads)
 {
-    if (!isModeReading()) {
-        qWarning() << WARNING_WRONGMODE;
-        return BufFile();
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    OptimizeReport report;
+
+    if (policy.level < 1 || policy.level > 10) {
+        qWarning() << "QMicroz: Invalid compression level:" << policy.level;
+        return report;
     }
 
-    const QString entryName = name(index);
-    if (entryName.isEmpty())
-        return BufFile();
+    ZipReader input(input_zip);
+    ZipWriter output(output_zip);
 
-    BufFile bufFile(entryName);
-    bufFile.data = extractData(index);
-    bufFile.modified = lastModified(index);
+    if (!input || !output)
+        return report;
 
-    return bufFile;
-}
+    if (threads <= 0)
+        threads = qMax(1, QThread::idealThreadCount());
 
-BufFile QMicroz::extractFileToBuf(const QString &fileName)
-{
-    return extractToBuf(findIndex(fileName));
-}
+    const int count = input.count();
+    const int window = threads * 4; // max number of the entries evaluated ahead of the writing
 
-QByteArray QMicroz::extractData(int index) const
-{
-    // Pointer to data
-    QByteArray extrRef = extractDataRef(index);
+    std::vector<std::unique_ptr<OptimizedEntry>> results(count);
+    std::mutex mutex;
+    std::condition_variable cond_done;    // an entry is evaluated
+    std::condition_variable cond_written; // an entry is written, or stopping
+    int next = 0;
+    int written = 0;
+    bool stopping = false;
 
-    if (extrRef.isNull())
-        return QByteArray();
+    // each worker reads the input through its own reader
+    auto worker = [&]() {
+        ZipReader reader(input_zip);
 
-    // Copy data
-    QByteArray extrCopy(extrRef.constData(), extrRef.size());
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond_written.wait(lock, [&] { return stopping || next >= count || next - written < window; });
 
-    // Clear extracted from the heap
-    free((void*)extrRef.constData());
+            if (stopping || next >= count)
+                break;
 
-    return extrCopy;
-}
+            const int index = next++;
+            lock.unlock();
 
-QByteArray QMicroz::extractDataRef(int index) const
-{
-    if (!isModeReading()) {
-        qWarning() << WARNING_WRONGMODE;
-        return QByteArray();
+            std::unique_ptr<OptimizedEntry> entry(new OptimizedEntry(optimizeEntry(reader, index, policy)));
+
+            if (policy.compressorProfile == CompressorProfile::LowMemory)
+                releaseThreadCompressor();
+
+            lock.lock();
+            results[index] = std::move(entry);
+            cond_done.notify_all();
+        }
+    }; // lambda worker
+
+    WorkersStats workers_stats;
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < qMin(threads, count); ++i) {
+        workers.emplace_back([&]() {
+            worker();
+            workers_stats.collect();
+        });
     }
 
-    /* When extracting a folder, the <mz_zip_reader_extract_to_heap>
-     * returns an empty array, but not a null pointer.
-     * So for convenience, at the moment we return a null array for folders.
-     * QByteArray().isNull();   // returns true
-     * QByteArray("").isNull(); // returns false
-     */
-    if (isFolder(index))
-        return QByteArray();
+    bool res = true;
 
-    if (m_verbose)
-        std::cout << "Extracting: " << name(index).toStdString();
+    // writing in the order of the input
+    for (int i = 0; i < count && res; ++i) {
+        std::unique_ptr<OptimizedEntry> entry;
 
-    // extracting...
-    size_t data_size = 0;
-    char *ch_data = (char*)mz_zip_reader_extract_to_heap(PZIP, index, &data_size, 0);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond_done.wait(lock, [&] { return results[i] != nullptr; });
+            entry = std::move(results[i]);
+        }
 
-    // Pointer to the data in the QByteArray.
-    // The Data should be deleted on the caller side: free((void*)ba.constData());
-    QByteArray extracted = ch_data ? QByteArray::fromRawData(ch_data, data_size) : QByteArray();
+        const EntryInfo &info = entry->info;
+        const QString name = info.name();
+
+        if (!entry->success) {
+            qWarning() << "QMicroz: Failed to read file:" << i << name;
+            res = false;
+        } else if (info.isFolder) {
+            res = output.addToZip(BufFile(name, info.lastModified()));
+        } else if (entry->deflated) {
+            res = output.addCompressed(name, entry->data, info.sizeUncompressed, info.crc32, info.lastModified());
+        } else {
+            BufFile buf_file(name, entry->data);
+            buf_file.modified = info.lastModified();
+            res = output.addStored(buf_file);
+        }
 
-    if (m_verbose)
-        std::cout << CH_SPACE << (ch_data ? RESULT_OK : RESULT_FAILED) << std::endl;
+        if (res) {
+            switch (entry->action) {
+            case OptimizedEntry::Recompressed: ++report.recompressed; break;
+            case OptimizedEntry::Stored: ++report.stored; break;
+            case OptimizedEntry::Copied: ++report.copied; break;
+            }
+        }
 
-    return extracted;
-}
+        std::lock_guard<std::mutex> lock(mutex);
+        ++written;
+        stopping = !res;
+        cond_written.notify_all();
+    }
 
+    for (std::thread &thread : workers) {
+        thread.join();
+    }
 
-/*** STATIC functions ***/
-bool QMicroz::extract(const QString &zip_path)
-{
-    // extract to parent folder
-    return extract(zip_path, QFileInfo(zip_path).absolutePath());
+    workers_stats.merge();
+
+    input.close();
+    res = output.close() && res;
+
+    report.success = res;
+    report.sizeBefore = QFileInfo(input_zip).size();
+    report.sizeAfter = QFileInfo(output_zip).size();
+    report.elapsedNs = elapsed.nsecsElapsed();
+    return report;
 }
 
-bool QMicroz::extract(const QString &zip_path, const QString &output_folder)
+/* Rewrites the central directory of the <zip_path> archive in place; the entries data is not touched.
+ * Each record name is passed to the <edit>, which returns false to drop the record, and may change the name.
+ */
+static bool rewriteCentralDir(const QString &zip_path, const std::function<bool(QByteArray &name)> &edit)
 {
-    QMicroz qmz(zip_path, ModeRead);
-    if (!qmz)
+    enum : quint32 { SigCentral = 0x02014b50, SigEnd = 0x06054b50 };
+    static const int central_size = 46; // fixed part of the central directory record
+    static const int end_size = 22;     // end of central directory record, without the comment
+    static const quint16 flag_utf8 = 1 << 11;
+
+    QFile file(zip_path);
+    if (!file.open(QFile::ReadWrite))
         return false;
 
-    qmz.setOutputFolder(output_folder);
-    return qmz.extractAll();
-}
+    // the end record is followed by the comment only
+    const qint64 tail_size = qMin<qint64>(file.size(), end_size + 0xffff);
+    if (!file.seek(file.size() - tail_size))
+        return false;
 
-/*** Compress ***/
-bool QMicroz::compress(const QString &path)
-{
-    QFileInfo fi(path);
+    const QByteArray tail = file.read(tail_size);
+    const uchar *t = reinterpret_cast<const uchar *>(tail.constData());
+    int end_pos = -1;
 
-    if (!fi.isFile() && !fi.isDir()) {
-        qWarning() << WARNING_WRONGPATH << path;
+    for (int i = tail.size() - end_size; i >= 0; --i) {
+        if (qFromLittleEndian<quint32>(t + i) == SigEnd
+            && i + end_size + qFromLittleEndian<quint16>(t + i + 20) == tail.size())
+        {
+            end_pos = i;
+            break;
+        }
+    }
+
+    if (end_pos < 0)
+        return false;
+
+    const quint16 count = qFromLittleEndian<quint16>(t + end_pos + 10);
+    const quint32 dir_size = qFromLittleEndian<quint32>(t + end_pos + 12);
+    const quint32 dir_ofs = qFromLittleEndian<quint32>(t + end_pos + 16);
+
+    if (count == 0xffff || dir_size == 0xffffffff || dir_ofs == 0xffffffff) {
+        qWarning() << "QMicroz: Zip64 archives are not supported:" << zip_path;
         return false;
     }
 
-    const QString base_name = fi.isFile() ? fi.completeBaseName() : fi.fileName();
-    const QString zip_name = base_name + s_zip_ext;
-    const QString zip_path = joinPath(fi.absolutePath(), zip_name);
+    if (!file.seek(dir_ofs))
+        return false;
 
-    return compress(path, zip_path);
+    const QByteArray dir = file.read(dir_size);
+    const uchar *d = reinterpret_cast<const uchar *>(dir.constData());
+    QByteArray new_dir;
+    new_dir.reserve(dir.size());
+    quint16 new_count = 0;
+    int pos = 0;
+
+    for (int i = 0; i < count; ++i) {
+        if (pos + central_size > dir.size() || qFromLittleEndian<quint32>(d + pos) != SigCentral)
+            return false;
+
+        const int name_len = qFromLittleEndian<quint16>(d + pos + 28);
+        const int rest_len = qFromLittleEndian<quint16>(d + pos + 30) + qFromLittleEndian<quint16>(d + pos + 32);
+        const int record_size = central_size + name_len + rest_len;
+
+        if (pos + record_size > dir.size())
+            return false;
+
+        QByteArray name = dir.mid(pos + central_size, name_len);
+
+        if (edit(name)) {
+            QByteArray header = dir.mid(pos, central_size);
+            uchar *h = reinterpret_cast<uchar *>(header.data());
+            qToLittleEndian<quint16>(quint16(name.size()), h + 28);
+
+            // a changed non-ASCII name is marked as UTF-8
+            if (name != dir.mid(pos + central_size, name_len)) {
+                bool ascii = true;
+                for (int j = 0; j < name.size() && ascii; ++j) {
+                    ascii = uchar(name.at(j)) < 0x80;
+                }
+
+                if (!ascii)
+                    qToLittleEndian<quint16>(qFromLittleEndian<quint16>(h + 8) | flag_utf8, h + 8);
+            }
+
+            new_dir += header;
+            new_dir += name;
+            new_dir += dir.mid(pos + central_size + name_len, rest_len);
+            ++new_count;
+        }
+
+        pos += record_size;
+    }
+
+    QByteArray end = tail.mid(end_pos);
+    uchar *e = reinterpret_cast<uchar *>(end.data());
+    qToLittleEndian<quint16>(new_count, e + 8);
+    qToLittleEndian<quint16>(new_count, e + 10);
+    qToLittleEndian<quint32>(quint32(new_dir.size()), e + 12);
+
+    return file.seek(dir_ofs)
+           && file.write(new_dir) == new_dir.size()
+           && file.write(end) == end.size()
+           && file.resize(dir_ofs + new_dir.size() + end.size());
 }
 
-bool QMicroz::compress(const QStringList &paths)
+bool QMicroz::removeEntry(const QString &zip_path, const QString &entry_name)
 {
-    if (paths.isEmpty())
+    const QByteArray raw_name = entry_name.toUtf8();
+    bool found = false;
+
+    auto edit = [&](QByteArray &name) {
+        if (name != raw_name)
+            return true;
+
+        found = true;
         return false;
+    }; // lambda edit
 
-    const QString root_folder = QFileInfo(paths.first()).absolutePath();
-    const QString zip_name = QFileInfo(root_folder).fileName() + s_zip_ext;
-    const QString zip_path = joinPath(root_folder, zip_name);
+    if (!rewriteCentralDir(zip_path, edit) || !found) {
+        qWarning() << "QMicroz: Failed to remove entry:" << entry_name;
+        return false;
+    }
 
-    return compress(paths, zip_path);
+    return true;
 }
 
-bool QMicroz::compress(const QString &source_path, const QString &zip_path)
+bool QMicroz::renameEntry(const QString &zip_path, const QString &entry_name, const QString &new_name)
 {
-    if (!QFileInfo::exists(source_path)) {
-        qWarning() << WARNING_WRONGPATH << source_path;
+    if (new_name.isEmpty() || isFolderName(entry_name) != isFolderName(new_name))
         return false;
+
+    // the new name must not be taken
+    {
+        ZipReader reader(zip_path);
+        if (!reader || reader.names().indexOf(new_name) >= 0) {
+            qWarning() << "QMicroz: Failed to rename entry:" << entry_name << "to" << new_name;
+            return false;
+        }
     }
 
-    QMicroz qmz(zip_path, ModeWrite);
+    const QByteArray raw_name = entry_name.toUtf8();
+    const QByteArray raw_new_name = new_name.toUtf8();
+    bool found = false;
 
-    return qmz && qmz.addToZip(source_path);
-}
+    auto edit = [&](QByteArray &name) {
+        if (name == raw_name) {
+            name = raw_new_name;
+            found = true;
+        }
+        return true;
+    }; // lambda edit
 
-bool QMicroz::compress(const QStringList &paths, const QString &zip_path)
-{
-    if (paths.isEmpty()) {
-        qWarning() << WARNING_NOINPUTDATA;
+    if (!rewriteCentralDir(zip_path, edit) || !found) {
+        qWarning() << "QMicroz: Failed to rename entry:" << entry_name << "to" << new_name;
         return false;
     }
 
-    /* At the moment we consider the parent folder of the first item in the list as the relative Root.
-     * Archive entries are created relative to this root.
-     * Paths from the list which do not have a common root are placed at the archive's root.
-     *
-     * TODO: a smarter function for parsing paths and building internal entries based on multiple roots is needed.
-     */
-    const QString root = QFileInfo(paths.first()).absolutePath();
-    QDir dir(root);
+    return true;
+}
 
-    QMicroz qmz(zip_path, ModeWrite);
-    if (!qmz)
-        return false;
+qint64 QMicroz::wastedSpace(const QString &zip_path)
+{
+    mz_zip_archive zip;
+    mz_zip_zero_struct(&zip);
 
-    // process
-    for (const QString &path : paths) {
-        QString relPath = path.startsWith(root) ? dir.relativeFilePath(path)
-                                                : QFileInfo(path).fileName();
+    if (!mz_zip_reader_init_file(&zip, zip_path.toUtf8().constData(), 0))
+        return -1;
 
-        if (!qmz.addToZip(path, relPath))
-            qWarning() << "QMicroz: Unable to add:" << path;
+    // the local records are followed by the central directory
+    qint64 used = 0;
+    bool res = true;
+
+    for (mz_uint i = 0; i < mz_zip_reader_get_num_files(&zip) && res; ++i) {
+        mz_zip_archive_file_stat file_stat;
+        const qint64 data_ofs = localDataOffset(&zip, i);
+        res = data_ofs >= 0 && mz_zip_reader_file_stat(&zip, i, &file_stat);
+
+        if (res) {
+            // local header, data and the data descriptor if any (with the signature)
+            used += data_ofs - file_stat.m_local_header_ofs + file_stat.m_comp_size
+                    + ((file_stat.m_bit_flag & 0x08) ? 16 : 0);
+        }
     }
 
-    return qmz.count() > 0;
+    const qint64 wasted = (qint64)zip.m_central_directory_file_ofs - used;
+    mz_zip_reader_end(&zip);
+
+    return res ? qMax<qint64>(wasted, 0) : -1;
 }
 
-bool QMicroz::compress(const BufList &buf_list, const QString &zip_path)
+bool QMicroz::compact(const QString &zip_path, double threshold)
 {
-    if (buf_list.isEmpty()) {
-        qWarning() << WARNING_NOINPUTDATA;
+    const qint64 wasted = wastedSpace(zip_path);
+
+    if (wasted < 0)
         return false;
-    }
 
-    QMicroz qmz(zip_path, ModeWrite);
+    if (wasted == 0 || wasted <= QFileInfo(zip_path).size() * threshold)
+        return true;
 
-    return qmz && qmz.addToZip(buf_list);
-}
+    TRACE_SPAN("compact", zip_path);
 
-bool QMicroz::compress(const BufFile &buf_file, const QString &zip_path)
-{
-    if (!buf_file) {
-        qWarning() << WARNING_NOINPUTDATA;
+    // written next to the archive, then replaces it
+    QTemporaryFile temp(zip_path + ".XXXXXX");
+    if (!temp.open())
         return false;
+
+    ZipReader reader(zip_path);
+    ZipWriter writer(temp.fileName());
+    bool res = reader && writer;
+
+    for (const EntryInfo &info : reader.entries()) {
+        if (!res)
+            break;
+
+        const QString name = info.name();
+
+        if (info.isFolder) {
+            res = writer.addToZip(BufFile(name, info.lastModified()));
+            continue;
+        }
+
+        const RawEntry raw = reader.extractRaw(info.index);
+
+        if (raw.method == RawEntry::Deflated) {
+            res = writer.addCompressed(name, raw.data, raw.sizeUncompressed, raw.crc32, info.lastModified());
+        } else if (raw.method == RawEntry::Stored) {
+            BufFile buf_file(name, raw.data);
+            buf_file.modified = info.lastModified();
+            // keeps the data aligned as it was
+            res = writer.setAlignment(reader.dataAlignment(info.index)) && writer.addStored(buf_file);
+        } else {
+            res = false;
+        }
     }
 
-    QMicroz qmz(zip_path, ModeWrite);
+    reader.close();
+    res = writer.close() && res;
 
-    return qmz && qmz.addToZip(buf_file);
-}
+    // the temporary file is owner-only
+    res = res && temp.setPermissions(QFileInfo(zip_path).permissions());
 
-bool QMicroz::compress(const QString &file_name,
-                       const QByteArray &file_data,
-                       const QString &zip_path)
-{
-    BufFile buf_file(file_name, file_data);
+    if (!res) {
+        qWarning() << "QMicroz: Failed to compact:" << zip_path;
+        return false;
+    }
 
-    return compress(buf_file, zip_path);
+    // the compacted copy is complete; kept if it can't replace the original
+    temp.setAutoRemove(false);
+
+    if (!replaceFile(temp.fileName(), zip_path)) {
+        qWarning() << "QMicroz: Failed to replace the archive:" << zip_path << "the compacted copy is kept:" << temp.fileName();
+        return false;
+    }
+
+    return true;
 }
 
 /*** Additional ***/
@@ -808,22 +4664,114 @@ bool QMicroz::isZipFile(const QString &filePath)
     return file.open(QFile::ReadOnly) && isArchive(file.read(2));
 }
 
-QString QMicroz::joinPath(const QString &abs_path, const QString &rel_path)
+/*** Statistics ***/
+qint64 QMicroz::Stats::totalNs() const
 {
-    auto isSep = [] (QChar ch) { return ch == '/' || ch == '\\'; };
+    return inflateNs + deflateNs + crcNs + digestNs + fileIoNs + mkdirNs + indexNs;
+}
 
-    const bool s1Ends = !abs_path.isEmpty() && isSep(abs_path.back());
-    const bool s2Starts = !rel_path.isEmpty() && isSep(rel_path.front());
+double QMicroz::Stats::throughput() const
+{
+    const qint64 total = totalNs();
+    return total > 0 ? bytesOut * 1e9 / total : 0.0;
+}
 
-    if (s1Ends && s2Starts) {
-        QStringView chopped = QStringView(abs_path).left(abs_path.size() - 1);
-        return chopped % rel_path;
+QMicroz::Stats& QMicroz::Stats::operator+=(const Stats &other)
+{
+    bytesIn += other.bytesIn;
+    bytesOut += other.bytesOut;
+    entries += other.entries;
+    inflateNs += other.inflateNs;
+    deflateNs += other.deflateNs;
+    crcNs += other.crcNs;
+    digestNs += other.digestNs;
+    fileIoNs += other.fileIoNs;
+    mkdirNs += other.mkdirNs;
+    indexNs += other.indexNs;
+
+    return *this;
+}
+
+QMicroz::Stats QMicroz::stats()
+{
+    return t_stats;
+}
+
+void QMicroz::resetStats()
+{
+    t_stats = Stats();
+}
+
+/*** Tracing ***/
+bool QMicroz::startTrace()
+{
+#if defined(RECORD_TRACE_EVENTS)
+    QMutexLocker locker(&s_trace_mutex);
+
+    if (s_trace_enabled.load(std::memory_order_acquire))
+        return false;
+
+    s_trace_events.clear();
+    s_trace_clock.start();
+    s_trace_enabled.store(true, std::memory_order_release);
+    return true;
+#else
+    qWarning() << "QMicroz: Built without TRACE_EVENTS option.";
+    return false;
+#endif
+}
+
+bool QMicroz::stopTrace(const QString &jsonPath)
+{
+#if defined(RECORD_TRACE_EVENTS)
+    std::vector<TraceEvent> events;
+
+    {
+        QMutexLocker locker(&s_trace_mutex);
+
+        if (!s_trace_enabled.exchange(false, std::memory_order_acq_rel))
+            return false;
+
+        events.swap(s_trace_events);
     }
 
-    if (s1Ends || s2Starts)
-        return abs_path + rel_path;
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray trace_events;
+
+    for (const TraceEvent &ev : events) {
+        QJsonObject obj;
+        obj["name"] = QString(ev.name);
+        obj["cat"] = QStringLiteral("qmicroz");
+        obj["ph"] = QStringLiteral("X"); // complete event
+        obj["ts"] = ev.startNs / 1000.0; // microseconds
+        obj["dur"] = ev.durNs / 1000.0;
+        obj["pid"] = pid;
+        obj["tid"] = ev.tid;
+
+        if (!ev.arg.isEmpty()) {
+            QJsonObject args;
+            args["path"] = ev.arg;
+            obj["args"] = args;
+        }
 
-    return abs_path % s_sep % rel_path;
+        trace_events.append(obj);
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = trace_events;
+    root["displayTimeUnit"] = QStringLiteral("ms");
+
+    QFile file(jsonPath);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << WARNING_WRONGPATH << jsonPath;
+        return false;
+    }
+
+    return file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) > 0;
+#else
+    Q_UNUSED(jsonPath)
+    return false;
+#endif
 }
 
 /*** OBSOLETE ***/
@@ -21,7 +21,15 @@
 
 #include <QObject>
 #include <QMap>
+#include <QVector>
 #include <QDateTime>
+#include <functional>
+#include <iterator>
+#include <memory>
+
+class QFile;
+class QTemporaryFile;
+struct FileDigester;
 
 // Used to store a file data in the memory
 struct QMICROZ_EXPORT BufFile {
@@ -39,13 +47,650 @@ struct QMICROZ_EXPORT BufFile {
     QDateTime modified; // last modified date and time
 }; // struct BufFile
 
+// Info about an archive entry, obtained by a single call: ZipArchive::entryInfo(index)
+struct QMICROZ_EXPORT EntryInfo {
+    explicit operator bool() const { return index >= 0; }
+    bool isFile() const { return index >= 0 && !isFolder; }
+
+    // Entry name/path, decoded only on request
+    QString name() const { return QString::fromUtf8(rawName); }
+
+    // Last modified date and time; invalid if not stored
+    QDateTime lastModified() const;
+
+    int index = -1;             // index of the entry in the archive, -1 if invalid
+    QByteArray rawName;         // entry name/path (UTF-8) as stored in the archive
+    bool isFolder = false;      // the name ends with '/'
+    qint64 sizeCompressed = 0;
+    qint64 sizeUncompressed = 0;
+    quint32 crc32 = 0;          // CRC-32 of the uncompressed data
+    qint64 modified = 0;        // last modified, seconds since epoch; 0 if not stored
+}; // struct EntryInfo
+
+// Compressed data of an entry as stored in the archive: ZipReader::extractRaw(index)
+struct QMICROZ_EXPORT RawEntry {
+    enum Method : quint16 { Stored = 0, Deflated = 8 };
+
+    explicit operator bool() const { return !data.isNull(); }
+
+    /* Wraps the data into a gzip member (RFC 1952), e.g. to send as "Content-Encoding: gzip".
+     * The deflated data is taken as is, the stored one is framed into the deflate stored blocks;
+     * so there is no compression/decompression at all. Returns an empty array for other methods.
+     */
+    QByteArray toGzip() const;
+
+    QByteArray data;              // compressed data: a raw deflate stream (RFC 1951) if Deflated
+    quint16 method = Stored;      // compression method
+    quint32 crc32 = 0;            // CRC-32 of the uncompressed data
+    qint64 sizeUncompressed = 0;
+    qint64 modified = 0;          // last modified, seconds since epoch; 0 if not stored
+}; // struct RawEntry
+
+// A match found in the file data: QMicroz::search(...)
+struct QMICROZ_EXPORT SearchHit {
+    int index = -1;         // index of the entry
+    qint64 offset = -1;     // offset of the match in the uncompressed data
+    QByteArray context;     // the match with up to 32 bytes of data on each side
+    int contextPos = 0;     // position of the match in the <context>
+}; // struct SearchHit
+
+/* Memory use of the deflate compressors of the concurrent adding and the queue: QMicroz::setCompressorProfile(...)
+ * ...and of the recompression: OptimizePolicy::compressorProfile
+ */
+enum class CompressorProfile {
+    Default,    // each thread keeps its compressor state for reuse; the files from disk are compressed into memory
+    LowMemory   // the state is freed after each file; the files from disk are streamed into the archive under the lock
+};
+
+// Settings of the archive recompression: QMicroz::optimize(...)
+struct QMICROZ_EXPORT OptimizePolicy {
+    int level = 9;            // deflate level of the recompression, 1..10; optimize() fails with the others
+    double minSaving = 0.02;  // a file stays deflated if it saves at least this part of its size, otherwise stored
+    CompressorProfile compressorProfile = CompressorProfile::Default; // memory use of the recompressing threads
+}; // struct OptimizePolicy
+
+/* Result of the archive recompression: QMicroz::optimize(...)
+ * Only the names, dates and data are rewritten; the external attributes (e.g. Unix permissions)
+ * and the extra fields of the input entries are not carried over.
+ */
+struct QMICROZ_EXPORT OptimizeReport {
+    explicit operator bool() const { return success; }
+
+    // Bytes saved by the recompression; negative if the output is larger
+    qint64 saved() const { return sizeBefore - sizeAfter; }
+
+    bool success = false;
+    int recompressed = 0;     // deflated anew, smaller than before
+    int stored = 0;           // not worth compressing (e.g. JPEG), converted to stored
+    int copied = 0;           // already optimal, copied as is; folders too
+    qint64 sizeBefore = 0;    // size of the input archive
+    qint64 sizeAfter = 0;     // ...and the output one
+    qint64 elapsedNs = 0;     // total time spent
+}; // struct OptimizeReport
+
+// Differences between two archives: QMicroz::diff(...)
+struct QMICROZ_EXPORT ArchiveDiff {
+    explicit operator bool() const { return success; }
+
+    // Whether the archives contain the same entries with the same data
+    bool isIdentical() const { return success && added.isEmpty() && removed.isEmpty() && modified.isEmpty(); }
+
+    bool success = false;
+    QStringList added;        // entries only in the second archive
+    QStringList removed;      // ...only in the first one
+    QStringList modified;     // files in both, with a different size, CRC-32 or content
+    int unchanged = 0;        // entries in both, the same
+}; // struct ArchiveDiff
+
+// Digest algorithms of the extraction manifest, the QCryptographicHash::Algorithm values, e.g. { QCryptographicHash::Sha256 }
+using DigestList = QVector<int>;
+
+// An extracted file with its digests: see Manifest
+struct QMICROZ_EXPORT ManifestEntry {
+    int index = -1;               // index of the entry in the archive
+    QString name;                 // entry name/path
+    qint64 size = 0;              // uncompressed size
+    quint32 crc32 = 0;            // CRC-32 from the central directory, verified on extraction
+    QVector<QByteArray> digests;  // in the order of the Manifest::algorithms
+}; // struct ManifestEntry
+
+// Digests of the files computed during extraction, without reading them again: ZipReader::extractAll(...)
+struct QMICROZ_EXPORT Manifest {
+    explicit operator bool() const { return success; }
+
+    bool success = false;
+    DigestList algorithms;
+    QVector<ManifestEntry> files; // in the order of the entries; no folders
+}; // struct Manifest
+
 // { "path inside zip" : data }
 using BufList = QMap<QString, QByteArray>;
 
+// Files in the order of adding, stored contiguously; an alternative to the BufList
+using BufFileList = QVector<BufFile>;
+
+/* Files { "path inside zip" : data } extracted within a memory budget: ZipReader::extractToBufBounded(...)
+ * The data is kept in RAM until the budget is reached. Further files, and the ones larger than the budget,
+ * are written to a temporary file which is mapped into memory: their pages are backed by the file,
+ * so the system can drop them instead of running out of RAM.
+ * Such QByteArrays do not own the data and are valid while this object exists. Movable, not copyable.
+ */
+class QMICROZ_EXPORT BoundedBufList
+{
+public:
+    BoundedBufList();
+    BoundedBufList(BoundedBufList &&other) noexcept;
+    BoundedBufList& operator=(BoundedBufList &&other) noexcept;
+    ~BoundedBufList();
+
+    // The extracted files; all of them, both in RAM and spilled
+    const BufList& list() const { return m_list; }
+
+    // Returns the data of the <fileName> file
+    QByteArray value(const QString &fileName) const { return m_list.value(fileName); }
+
+    // Total size of the data held in RAM
+    qint64 memorySize() const { return m_memory_size; }
+
+    // ...written to the temporary file
+    qint64 spilledSize() const { return m_spilled_size; }
+
+private:
+    friend class ZipReader;
+
+    BufList m_list;
+    qint64 m_memory_size = 0;
+    qint64 m_spilled_size = 0;
+
+    // The spilled data; removed on destruction
+    std::unique_ptr<QTemporaryFile> m_spill_file;
+}; // class BoundedBufList
+
 // List of files { "entry name/path" : index } contained in the archive
 using ZipContents = QMap<QString, int>;
 
+// Selects the entries to process; an empty one selects all
+using EntryFilter = std::function<bool(const EntryInfo &entry)>;
+
+/* Receives the entry and its extracted <data>. The <data> is a view of a scratch buffer,
+ * valid only during the call; copy it to keep. Returns false to stop.
+ */
+using EntryVisitor = std::function<bool(const EntryInfo &entry, const QByteArray &data)>;
+
+/* Compact store of the entry names for large archives: an alternative to ZipContents.
+ * Names are kept in a single UTF-8 pool, each folder path is stored once and shared
+ * by all its entries, which keep only the folder id and their own name.
+ * About 20-28 bytes per entry plus the own name, instead of a QMap node with a UTF-16 QString.
+ * The returned views point into the pool and are valid until the next append() or clear().
+ */
+class QMICROZ_EXPORT ZipNames
+{
+public:
+    int size() const { return int(m_items.size()); }
+    bool isEmpty() const { return m_items.isEmpty(); }
+
+    // Adds the entry name/path (UTF-8); its index is the previous size()
+    void append(const QByteArray &path);
+
+    // Removes all names and frees the memory
+    void clear();
+
+    // Frees the unused capacity; call when all names are added
+    void squeeze();
+
+    // Returns the index of the entry with <path>, -1 if not found
+    int indexOf(const QByteArray &path) const;
+    int indexOf(const QString &path) const { return indexOf(path.toUtf8()); }
+
+    // Returns the view of the parent folder path ("folder/subfolder/"); empty for the root entries
+    QByteArray folderView(int index) const;
+
+    // Returns the view of the own entry name ("file.txt" or "subfolder/")
+    QByteArray fileNameView(int index) const;
+
+    // Returns the full entry name/path (UTF-8)
+    QByteArray path(int index) const;
+
+    // ...decoded
+    QString name(int index) const { return QString::fromUtf8(path(index)); }
+
+    // Number of bytes allocated by the store
+    qint64 memoryUsage() const;
+
+private:
+    // A part of the <m_pool>
+    struct Span { quint32 offset; quint32 size; };
+
+    // An entry: the folder id and the own name
+    struct Item { quint32 folder; Span name; };
+
+    QByteArray view(const Span &span) const;
+
+    // Returns the slot of the <name> in the <folder>, or of the empty one to insert it
+    int itemSlot(quint32 folder, const char *name, int size) const;
+
+    // ...of the folder <path>
+    int folderSlot(const char *path, int size) const;
+
+    // Returns the id of the folder <path>, adds it if needed
+    quint32 addFolder(const char *path, int size);
+
+    // Adds the <span> to the pool
+    Span addToPool(const char *data, int size);
+
+    // Grows the open addressing tables when they are half full
+    void rehash();
+
+    QByteArray m_pool;              // UTF-8 names: folder paths and own entry names
+    QVector<Item> m_items;          // by entry index
+    QVector<Span> m_folders;        // by folder id
+    QVector<qint32> m_item_slots;   // hash table of the entry indexes, -1 is empty
+    QVector<qint32> m_folder_slots; // ...of the folder ids
+}; // class ZipNames
+
+
+/* Common part of the ZipReader and ZipWriter: the archive handle and info about the entries.
+ * Plain value types, without QObject overhead. Movable, not copyable.
+ * An object is not thread-safe, just like the underlying miniz archive.
+ */
+class QMICROZ_EXPORT ZipArchive
+{
+public:
+    // Whether the archive is opened
+    bool isOpen() const { return m_archive; }
+    explicit operator bool() const { return isOpen(); }
+
+    // Returns the path to the zip file; empty for a buffered archive
+    const QString& zipFilePath() const;
+
+    // Archive size
+    qint64 sizeCompressed() const;
+
+    // Total uncompressed data size (space required for extraction)
+    qint64 sizeUncompressed() const;
+
+    // Returns the number of items in the archive
+    int count() const;
+
+    // Whether the index belongs to the folder entry
+    bool isFolder(int index) const;
+
+    // ... to the file entry
+    bool isFile(int index) const;
+
+    // Returns the name/path corresponding to the index
+    QString name(int index) const;
+
+    // Returns the compressed size of the file at the specified index
+    qint64 sizeCompressed(int index) const;
+
+    // ...the uncompressed size
+    qint64 sizeUncompressed(int index) const;
+
+    // Returns the file modification date stored in the archive
+    QDateTime lastModified(int index) const;
+
+    // Returns all the info about the entry at once; invalid EntryInfo if failed
+    EntryInfo entryInfo(int index) const;
+
+    /* Forward range over the entries, one central directory read per entry:
+     * for (const EntryInfo &entry : zip.entries()) {...}
+     * The iterator reuses its EntryInfo, so copy the entry to keep it.
+     */
+    class QMICROZ_EXPORT Entries
+    {
+    public:
+        class QMICROZ_EXPORT const_iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = EntryInfo;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const EntryInfo *;
+            using reference = const EntryInfo &;
+
+            const_iterator(const ZipArchive *archive, int index);
+
+            reference operator*() const { return m_info; }
+            pointer operator->() const { return &m_info; }
+            const_iterator& operator++();
+            const_iterator operator++(int) { const_iterator tmp = *this; ++*this; return tmp; }
+
+            bool operator==(const const_iterator &other) const { return m_index == other.m_index; }
+            bool operator!=(const const_iterator &other) const { return m_index != other.m_index; }
+
+        private:
+            const ZipArchive *m_archive;
+            int m_index;
+            EntryInfo m_info;
+        }; // class const_iterator
+
+        explicit Entries(const ZipArchive *archive) : m_archive(archive) {}
+
+        const_iterator begin() const { return const_iterator(m_archive, 0); }
+        const_iterator end() const { return const_iterator(m_archive, m_archive->count()); }
+        int size() const { return m_archive->count(); }
+
+    private:
+        const ZipArchive *m_archive;
+    }; // class Entries
+
+    // Returns the range of all entries, see <Entries>
+    Entries entries() const { return Entries(this); }
+
+    // Sets a more verbose output into the terminal (more text)
+    void setVerbose(bool enable);
+
+protected:
+    ZipArchive() = default;
+    ~ZipArchive() = default;
+    ZipArchive(ZipArchive &&other) noexcept;
+    ZipArchive& operator=(ZipArchive &&other) noexcept;
+
+    // Fills the <info> of the entry with <index>, reusing its name buffer
+    bool readEntryInfo(int index, EntryInfo &info) const;
+
+    // The void pointer is used to allow the miniz header not to be included
+    void *m_archive = nullptr;
+
+    // Whether to display more info into the terminal
+    bool m_verbose = false;
+
+    // Path to the current zip file
+    QString m_zip_path;
+}; // class ZipArchive
+
+
+// Reads and extracts an archive stored on disk or in memory
+class QMICROZ_EXPORT ZipReader : public ZipArchive
+{
+public:
+    ZipReader() = default;
+
+    // To avoid ambiguity...
+    explicit ZipReader(const char *zipPath);
+
+    // Opens the <zipPath> archive, just like the <open> func.
+    explicit ZipReader(const QString &zipPath);
+
+    // Opens the <bufferedZip> archive, just like the <openBuffer> func.
+    explicit ZipReader(const QByteArray &bufferedZip);
+
+    ZipReader(ZipReader &&other) noexcept;
+    ZipReader& operator=(ZipReader &&other) noexcept;
+    ~ZipReader();
+
+    // Opens an existing zip file for Reading
+    bool open(const QString &zipPath);
+
+    // Opens a buffered in memory zip archive; the buffer is shared, not copied
+    bool openBuffer(const QByteArray &bufferedZip);
+
+    // Closes the archive and clears the member values
+    void close();
+
+    // Opens the zip archive contained in the entry with <index>, see QMicroz::openNested
+    ZipReader openNested(int index) const;
+
+    // Returns a list of entries { "name/path" : index } contained in the archive
+    const ZipContents& contents() const;
+
+    // Returns the compact store of the entry names, built once on request; see <ZipNames>
+    const ZipNames& names() const;
+
+    // Returns the index of the <fileName> entry, -1 if not found; uses the <names> store
+    int findIndex(const QString &fileName) const;
+
+    // Extracts the entire contents of the archive into the <outputFolder>
+    bool extractAll(const QString &outputFolder) const;
+
+    // The same, computing the digests of the files on the fly, see QMicroz::extractAll(algorithms, threads)
+    Manifest extractAll(const QString &outputFolder, const DigestList &algorithms, int threads = 1) const;
+
+    // Extracts only the files that differ from the ones in the <outputFolder>, see QMicroz::updateAll
+    bool updateAll(const QString &outputFolder, bool verifyCrc = false) const;
+
+    // Extracts the entry with <index> to disk: --> <outputFolder/entry_path>
+    bool extractToFolder(int index, const QString &outputFolder) const;
+
+    // Extracts the entry with <index> to disk: --> custom <outputPath>
+    bool extractIndex(int index, const QString &outputPath) const;
+
+    // Extracts the <folderName> and its contents to disk: <outputPath/contents>
+    bool extractFolder(const QString &folderName, const QString &outputPath) const;
+
+    // ...computing the digests of the files on the fly
+    Manifest extractFolder(const QString &folderName, const QString &outputPath,
+                           const DigestList &algorithms, int threads = 1) const;
+
+    // Extracts all files into the RAM buffer { "name/path" : data }
+    BufList extractToBuf() const;
+
+    // Extracts a file with <index> into the buffer
+    BufFile extractToBuf(int index) const;
+
+    // Extracts all files within the <memoryBudget>, see QMicroz::extractToBufBounded
+    BoundedBufList extractToBufBounded(qint64 memoryBudget, const QString &spillFolder = QString()) const;
+
+    // Returns the extracted file data; the QByteArray owns the copied data
+    QByteArray extractData(int index) const;
+
+    // Returns the extracted file data; the QByteArray does NOT own the data, see QMicroz::extractDataRef
+    QByteArray extractDataRef(int index) const;
+
+    // Writes the file with <index> to the file descriptor, see QMicroz::extractToFd
+    bool extractToFd(int index, int fd) const;
+
+    // Returns the compressed data of the entry as is, see QMicroz::extractRaw
+    RawEntry extractRaw(int index) const;
+
+    // Returns the offset of the file data in the archive, see QMicroz::dataOffset
+    qint64 dataOffset(int index) const;
+
+    // Returns the alignment of the stored file data set by ZipWriter::setAlignment, 0 if not aligned
+    int dataAlignment(int index) const;
+
+    // Returns a view of the stored file data without copying, see QMicroz::mapStored
+    QByteArray mapStored(int index) const;
+
+    // Streams the entries through a single reused buffer, see QMicroz::forEachEntry
+    bool forEachEntry(const EntryFilter &filter, const EntryVisitor &visitor) const;
+
+    // ...computing the digests of the visited files, see QMicroz::forEachEntry
+    Manifest forEachEntry(const EntryFilter &filter, const EntryVisitor &visitor, const DigestList &algorithms) const;
+
+    // Searches the file data for the <pattern> on several threads, see QMicroz::search
+    QVector<SearchHit> search(const QByteArray &pattern, const EntryFilter &filter = EntryFilter(),
+                              int threads = 0, bool firstOnly = false) const;
+
+    // Compares the entries with the <other> archive, see QMicroz::diff
+    ArchiveDiff diff(const ZipReader &other, bool verifyContent = false) const;
+
+private:
+    // Whether the file with <index> has the same data as the <otherIndex> one of the <other> archive
+    bool sameContent(int index, const ZipReader &other, int otherIndex) const;
+
+    // Opens another reader of the same archive, e.g. for another thread
+    ZipReader duplicate() const;
+
+    // Extracts the file with <index>, passing its data to the <digester> if set
+    bool extractToFolder(int index, const QString &outputFolder, FileDigester *digester) const;
+    bool extractIndex(int index, const QString &outputPath, FileDigester *digester) const;
+
+    /* Extracts the entries with <indexes> on the <threads>, each through its own reader:
+     * the <extract> is called with the reader and the number of the entry in the <indexes>.
+     */
+    Manifest extractManifest(const QVector<int> &indexes,
+                             const std::function<bool(const ZipReader &, int, FileDigester *)> &extract,
+                             const DigestList &algorithms, int threads) const;
+
+    // Opens the <size> bytes of the <zipPath> file from the <offset>; the whole file if the <size> is 0
+    bool openFile(const QString &zipPath, qint64 offset, qint64 size);
+
+    // Opens the <size> bytes of the <buffer> from the <offset>; the whole buffer is kept alive
+    bool openBuffer(const QByteArray &buffer, qint64 offset, qint64 size);
+
+    /* Copies the stored (not compressed) file data to the <fd> in the kernel, once its CRC-32 is verified; Linux only.
+     * Only the files from 1 MiB: the smaller ones are left to the decoder (returns 0).
+     */
+    qint64 copyStored(int index, int fd) const;
+
+    // Keeps the buffered zip alive while it is opened
+    QByteArray m_buffer;
+
+    // Offset of the archive in the <m_buffer>; not 0 for a nested one
+    qint64 m_buffer_offset = 0;
+
+    // The zip file mapped into memory for the <mapStored> views; mapped on request
+    mutable std::unique_ptr<QFile> m_map_file;
+    mutable uchar *m_mapped = nullptr;
+
+    // Holds a list of the archive contents { "entry name/path" : index }; cached on request
+    mutable ZipContents m_contents;
+
+    // Compact names of the entries; cached on request
+    mutable ZipNames m_names;
+}; // class ZipReader
+
+
+// Creates a new zip file and adds entries to it
+class QMICROZ_EXPORT ZipWriter : public ZipArchive
+{
+public:
+    ZipWriter();
+
+    // Creates the <zipPath> archive, just like the <open> func.
+    explicit ZipWriter(const QString &zipPath);
 
+    ZipWriter(ZipWriter &&other) noexcept;
+    ZipWriter& operator=(ZipWriter &&other) noexcept;
+
+    // Finalizes the archive if it is still opened
+    ~ZipWriter();
+
+    // Creates the <zipPath> file for Writing, regardless of its existence
+    bool open(const QString &zipPath);
+
+    /* Opens an in memory archive for Writing, see QMicroz::setZipBuffer(bufferedZip, mode)
+     * <reserve> is the expected size of the output, allocated at once.
+     */
+    bool openBuffer(const QByteArray &bufferedZip = QByteArray(), qint64 reserve = 0);
+
+    // Writes the central directory, closes the file and clears the member values
+    bool close();
+
+    // Closes the in memory archive if still opened and returns it; empty for a zip file
+    QByteArray takeBuffer();
+
+    // Returns a list of the added entries { "name/path" : index }
+    const ZipContents& contents() const;
+
+    /* Adds a file or folder (including contents) to the archive.
+     * <sourcePath> is a path to the file or folder on the file system.
+     * <entryName> its name or path inside the archive.
+     */
+    bool addToZip(const QString &sourcePath, const QString &entryName);
+
+    /* Adds a file based on <bufFile> data.
+     * To add an empty folder entry, append '/' to the <bufFile.name>
+     */
+    bool addToZip(const BufFile &bufFile);
+
+    // Adds files from the listed paths and data
+    bool addToZip(const BufList &bufList);
+
+    // ...releasing each file data right after it is written
+    bool addToZip(BufList &&bufList);
+
+    // Adds files in the order of the list
+    bool addToZip(const BufFileList &bufFiles);
+
+    // ...releasing each file data right after it is written
+    bool addToZip(BufFileList &&bufFiles);
+
+    // Adds a file without compression, see QMicroz::addStored
+    bool addStored(const BufFile &bufFile);
+
+    // Adds a single file from the file system without compression
+    bool addStored(const QString &sourcePath, const QString &entryName);
+
+    // Aligns the data of the stored files, see QMicroz::setAlignment
+    bool setAlignment(int alignment);
+
+    // Adds a file from the compressed beforehand data, see QMicroz::addCompressed
+    bool addCompressed(const QString &entryName, const QByteArray &rawDeflate,
+                       qint64 size, quint32 crc32, const QDateTime &modified = QDateTime());
+
+    // Adds a file from the gzip member, see QMicroz::addGzip
+    bool addGzip(const QString &entryName, const QByteArray &gzipData, const QDateTime &modified = QDateTime());
+
+    // Compress on the calling threads, to call <addToZip> concurrently, see QMicroz::setConcurrent
+    void setConcurrent(bool enable);
+
+    // Sets the memory use of the concurrent compression, see QMicroz::setCompressorProfile
+    void setCompressorProfile(CompressorProfile profile);
+
+    // Starts the background compression, see QMicroz::startQueue
+    bool startQueue(int capacity = 64, int threads = 0);
+
+    // Thread-safe. Enqueues the file for the background compression, see QMicroz::enqueue
+    bool enqueue(BufFile bufFile, bool blockIfFull = true);
+
+    // Waits until all enqueued files are written; false if any of them failed since the last call
+    bool waitForQueue();
+
+    // Writes the rest of the queue and stops the threads; called by <close>
+    bool stopQueue();
+
+private:
+    struct Queue;
+    struct Locks;
+
+    // Stops the queue of the <writer> to be moved from: the queue threads refer to the object
+    static ZipWriter&& withQueueStopped(ZipWriter &writer);
+
+    // Returns the current queue, kept alive by the caller; null if not started
+    std::shared_ptr<Queue> currentQueue() const;
+
+    // Compresses the <bufFile> on the calling thread and adds it
+    bool addConcurrently(const BufFile &bufFile);
+
+    /* If the <entryName> is not in the <m_entries> list:
+     * 1. adds item to the archive using the <addFunc>.
+     * 2. adds the <entryName> to the <m_entries>.
+     */
+    bool addEntry(const QString &entryName, std::function<bool()> addFunc);
+
+    // Adds a single file from the file system; without compression if <store>
+    bool addFile(const QString &sourcePath, const QString &entryName, bool store = false);
+
+    // Adds the <bufFile> on the calling thread; without compression if <store>
+    bool addBuf(const BufFile &bufFile, bool store);
+
+    // Holds a list of the added entries { "entry name/path" : index }
+    ZipContents m_entries;
+
+    // Whether to compress on the calling threads
+    bool m_concurrent = false;
+
+    // Memory use of the compression on the calling and queue threads
+    CompressorProfile m_profile = CompressorProfile::Default;
+
+    // Boundary of the stored files data; 0 if not aligned
+    int m_alignment = 0;
+
+    // The in memory archive; allocated by <openBuffer>, so its address is kept when moving
+    std::unique_ptr<QByteArray> m_buffer;
+
+    // Serializes the archive writes and guards the <m_queue> pointer; not moved with the object
+    std::unique_ptr<Locks> m_locks;
+
+    // Background compression threads; created by <startQueue>, shared with the waiting producers
+    std::shared_ptr<Queue> m_queue;
+}; // class ZipWriter
+
+
+// QObject-based wrapper over the ZipReader/ZipWriter: opens an archive in the needed mode, extracts to the output folder
 class QMICROZ_EXPORT QMicroz : public QObject
 {
     Q_OBJECT
@@ -87,12 +732,31 @@ public:
     // Sets a buffered in memory zip archive
     bool setZipBuffer(const QByteArray &bufferedZip);
 
+    /* Sets a buffered in memory zip archive for Reading (ModeRead, ModeAuto) or Writing (ModeWrite).
+     * ModeWrite
+     * An empty <bufferedZip> starts a new archive, otherwise the added files are appended to its entries.
+     * The <bufferedZip> itself is not modified: the data is copied once on the first write (copy-on-write).
+     * The output grows geometrically in place; call <takeBuffer> to get the archive without copying.
+     */
+    bool setZipBuffer(const QByteArray &bufferedZip, Mode mode);
+
+    // Finalizes the in memory archive opened for Writing and returns it; the archive is closed
+    QByteArray takeBuffer();
+
     // Path to the folder where to place the extracted files; empty --> parent dir
     void setOutputFolder(const QString &outputFolder = QString());
 
     // Closes the currently opened zip and clears the member values
     void closeArchive();
 
+    /* Returns a new object Reading the zip archive contained in the file with <index> (e.g. EPUB or JAR),
+     * without extracting it to disk; nullptr if the file is not an archive.
+     * A stored inner archive is read in place: from the same zip file (a range of it), or the same buffer.
+     * A deflated one is inflated into memory once, and only that inner archive is kept.
+     * The returned object is independent of this one.
+     */
+    std::unique_ptr<QMicroz> openNested(int index) const;
+
     // Sets a more verbose output into the terminal (more text)
     void setVerbose(bool enable);
 
@@ -145,6 +809,12 @@ public:
     // Returns the file modification date stored in the archive
     QDateTime lastModified(int index) const;
 
+    // Returns all the info about the entry at once; faster than the separate calls above
+    EntryInfo entryInfo(int index) const;
+
+    // Returns the range of all entries: for (const EntryInfo &entry : qmz.entries()) {...}
+    ZipArchive::Entries entries() const;
+
 
     /*** Adding to the archive ***/
     // Adds a file or folder (including all contents) to the root of the archive
@@ -170,11 +840,109 @@ public:
     // Adds files from the listed paths and data
     bool addToZip(const BufList &bufList);
 
+    /* The same, but consumes the <bufList>: each file data is released right after it is written,
+     * so the peak memory is not all the inputs plus the compressor state.
+     * The memory is freed only if the data is not shared with other QByteArrays.
+     */
+    bool addToZip(BufList &&bufList);
+
+    // Adds files in the order of the list
+    bool addToZip(const BufFileList &bufFiles);
+
+    // ...consuming the list, see addToZip(BufList &&)
+    bool addToZip(BufFileList &&bufFiles);
+
+
+    /* Adds a file from the data compressed beforehand, without recompressing (only a copy).
+     * <rawDeflate> is a raw deflate stream (RFC 1951, no zlib or gzip header)
+     * of the <size> bytes of data with the <crc32> checksum; they are written to the archive as is.
+     * An empty file (<size> 0) is stored, the <rawDeflate> is ignored.
+     * <modified> is the last modified date; invalid to set current.
+     */
+    bool addCompressed(const QString &entryName, const QByteArray &rawDeflate,
+                       qint64 size, quint32 crc32, const QDateTime &modified = QDateTime());
+
+    /* Adds a file from the single gzip member (RFC 1952), e.g. a "Content-Encoding: gzip" body.
+     * The deflate stream is taken from the member as is, the size and CRC-32 from its trailer,
+     * so the uncompressed data must be less than 4 GB. The gzip MTIME is used if <modified> is invalid.
+     */
+    bool addGzip(const QString &entryName, const QByteArray &gzipData, const QDateTime &modified = QDateTime());
+
+    /* Adds the <bufFile> without compression, e.g. the assets to be mapped from the archive (see <mapStored>).
+     * Folders are added as with <addToZip>.
+     */
+    bool addStored(const BufFile &bufFile);
+
+    // Adds the <sourcePath> file from the file system without compression, as the <entryName>
+    bool addStored(const QString &sourcePath, const QString &entryName);
+
+    /* Aligns the data of the stored files added next to the <alignment> boundary, like the zipalign:
+     * the local header extra field is padded, so the data can be mapped straight from the archive.
+     * <alignment> is a power of two up to 65536, e.g. 4096 for the memory pages; 0 to disable.
+     */
+    bool setAlignment(int alignment);
+
+
+    /*** Concurrent adding ***/
+    /* Enables <addToZip> calls from several threads into this archive.
+     * The data is compressed on the calling threads, and only the append of the compressed data
+     * with its central directory record is serialized. A file from disk is compressed into memory first,
+     * so the peak memory grows by its compressed size; therefore disabled by default.
+     * The other functions must not be called until the adding threads are finished.
+     */
+    void setConcurrent(bool enable);
+
+    /* Sets the memory use of the concurrent adding and the queue, e.g. to fit N parallel compressors within a fixed RAM cap.
+     * A compressor state takes <compressorMemory> bytes: kept by each adding or queue thread by default,
+     * or freed after each file with the LowMemory profile; the files from disk are then not buffered in memory
+     * (compressed size), but streamed into the archive by 64 KB chunks, serialized with the other writes.
+     * The queue takes the profile set before <startQueue>. See CompressorProfile.
+     */
+    void setCompressorProfile(CompressorProfile profile);
+
+    /* Returns the size of a deflate compressor state: its dictionary, hash tables and output buffers.
+     * About 312 KB; about 164 KB if the library is built with the LESS_MEMORY option (TDEFL_LESS_MEMORY),
+     * which shrinks the hash table to 4K entries and the buffers, for a slightly worse and slower compression.
+     */
+    static qint64 compressorMemory();
+
+
+    /*** Background compression queue ***/
+    /* Starts a pool of <threads> (the ideal number if <= 0) compressing the enqueued files in the background,
+     * and a single writer adding them to the archive in the order of enqueueing.
+     * <capacity> is the max number of the enqueued files not written yet, which bounds the memory usage.
+     */
+    bool startQueue(int capacity = 64, int threads = 0);
+
+    /* Thread-safe: can be called by several producer threads while the queue is started.
+     * Enqueues the <bufFile> and returns at once, the file is compressed and written in the background.
+     * If the queue is full, waits for a free place, or returns false at once if <blockIfFull> is false.
+     * Pass the file with std::move to avoid keeping a copy of the data.
+     */
+    bool enqueue(BufFile bufFile, bool blockIfFull = true);
+
+    // Waits until all enqueued files are written; returns false if any of them failed since the last call
+    bool waitForQueue();
+
 
     /*** Extraction ***/
     // Extracts the entire contents of the archive into the output folder (the parent one if not set)
     bool extractAll();
 
+    /* The same, computing the <algorithms> digests (e.g. SHA-256) of the files in one pass:
+     * the inflated data is hashed while it is written, so the files are not read again.
+     * The entries are extracted on the <threads> (the ideal number if <= 0), each through its own reader;
+     * the entries with the same name are extracted by one thread, in order.
+     * Returns the digests of the extracted files; see Manifest.
+     */
+    Manifest extractAll(const DigestList &algorithms, int threads = 1);
+
+    /* The same, but skips the files already up to date on disk, e.g. to redeploy onto the same folder:
+     * an existing file with the same size and modification date as the entry is not inflated and written.
+     * If <verifyCrc>, the CRC-32 of such a file is compared too (reading it, but still not writing).
+     */
+    bool updateAll(bool verifyCrc = false);
+
     /* Extracts the file with <index> to disk: --> <output_folder/entry_path> */
     bool extractIndex(int index);
 
@@ -196,12 +964,25 @@ public:
     /* Extracts the <folderName> and its contents to disk: <outputPath/contents> */
     bool extractFolder(const QString &folderName, const QString &outputPath);
 
+    // ...computing the digests of the files in one pass, see extractAll(algorithms, threads)
+    Manifest extractFolder(const QString &folderName, const QString &outputPath,
+                           const DigestList &algorithms, int threads = 1);
+
     // Extracts all files into the RAM buffer { "name/path" : data }
     BufList extractToBuf();
 
     // Extracts a file with <index> into the buffer
     BufFile extractToBuf(int index) const;
 
+    /* Extracts all files into the RAM buffer, but keeps no more than <memoryBudget> bytes in RAM.
+     * The rest is spilled to a temporary file in the <spillFolder> (system temp if empty) and mapped.
+     * Files that fail to extract, or to be mapped, are missing from the list; each one is warned about.
+     * Of the entries with the same name, the last one is kept, as by <extractToBuf>.
+     * Returns an empty list if the spill file can't be truncated after a failed file.
+     * See <BoundedBufList>.
+     */
+    BoundedBufList extractToBufBounded(qint64 memoryBudget, const QString &spillFolder = QString()) const;
+
     // Searches for a <fileName> and, if found, extracts it to the buffer; slower than <index>
     BufFile extractFileToBuf(const QString &fileName);
 
@@ -218,6 +999,58 @@ public:
      */
     QByteArray extractDataRef(int index) const;
 
+    /* Writes the file with <index> to the <fd>: a file or a socket (blocking) opened for writing.
+     * On Linux the stored (not compressed) files of the zip file are copied in the kernel
+     * with copy_file_range/sendfile, bypassing the user space; their CRC-32 is verified in the mapped archive first.
+     * The <fd> is not closed.
+     */
+    bool extractToFd(int index, int fd) const;
+
+    /* Returns the compressed data of the file with <index> as it is stored in the archive,
+     * along with the compression method, CRC-32 and size; without decompressing.
+     * Invalid RawEntry for folders and on failure. See RawEntry::toGzip()
+     */
+    RawEntry extractRaw(int index) const;
+
+    /* Returns the offset of the file with <index> data within the archive (after its local header), -1 if failed.
+     * For the stored files: to map or read the data straight from the archive file.
+     */
+    qint64 dataOffset(int index) const;
+
+    /* Returns a view of the stored (not compressed) file with <index> data, without copying:
+     * in the buffer of a buffered archive, or in the zip file mapped into memory once on the first call.
+     * The view is valid until the archive is closed. The data of the files added after <setAlignment>
+     * keeps its alignment in the mapping. Null for the compressed files and folders, and on failure.
+     */
+    QByteArray mapStored(int index) const;
+
+    /* Extracts the entries accepted by the <filter> one by one into a single reused buffer
+     * and passes each to the <visitor>: for jobs that read every file once (indexing, checksums).
+     * Peak memory is the largest entry instead of the whole archive, as with <extractToBuf>.
+     * Folder entries are passed with empty data.
+     * Returns false if any extraction failed or the <visitor> stopped.
+     */
+    bool forEachEntry(const EntryFilter &filter, const EntryVisitor &visitor) const;
+
+    /* The same, also computing the <algorithms> digests of the visited files
+     * right after their extraction into the buffer, while the data is hot in the cache.
+     * Returns the digests; not successful if any extraction failed or the <visitor> stopped.
+     */
+    Manifest forEachEntry(const EntryFilter &filter, const EntryVisitor &visitor, const DigestList &algorithms) const;
+
+    /* Searches the data of the files accepted by the <filter> (all if not set) for the <pattern>,
+     * on the <threads> (the ideal number if <= 0), each through its own reader of the archive.
+     * The files are inflated by chunks into small reused buffers, and the matches spanning the chunks are found too;
+     * so the memory doesn't depend on the file sizes, but on the number of matches: all are kept, each with its context
+     * (up to 64 bytes + the pattern). Use <firstOnly> or a more specific pattern for the frequent ones.
+     * The <filter> is called on the search threads; their counters are added to the caller's <stats>.
+     * If <firstOnly>, only the first match in the order of the entries is returned: the entries after a found match
+     * are skipped, and the search waits only for the earlier ones.
+     * Returns the matches ordered by the entry index and offset.
+     */
+    QVector<SearchHit> search(const QByteArray &pattern, const EntryFilter &filter = EntryFilter(),
+                              int threads = 0, bool firstOnly = false) const;
+
 
     /*** STATIC functions ***/
     // Extracts the zip into the parent folder
@@ -241,15 +1074,74 @@ public:
     // Creates an archive with files from the listed paths and data
     static bool compress(const BufList &buf_list, const QString &zip_path);
 
+    // ...consuming the <buf_list>: each file data is released right after it is written
+    static bool compress(BufList &&buf_list, const QString &zip_path);
+
+    // Creates an archive with files in the order of the <buf_files>
+    static bool compress(const BufFileList &buf_files, const QString &zip_path);
+
+    // ...consuming the <buf_files>
+    static bool compress(BufFileList &&buf_files, const QString &zip_path);
+
     // Creates an archive containing a single file based on <buf_file>
     static bool compress(const BufFile &buf_file, const QString &zip_path);
 
+    /* Creates an archive in memory with files from the listed paths and data, e.g. per HTTP request.
+     * The output is allocated once by the size estimated from the inputs (the stored files exactly,
+     * the deflated ones by the deflate bound) and returned without copying. Empty on failure.
+     */
+    static QByteArray compressToBuf(const BufList &buf_list);
+
+    // ...with files in the order of the <buf_files>
+    static QByteArray compressToBuf(const BufFileList &buf_files);
+
     /* Creates an archive <zip_path> containing a file (<file_name>, <file_data>)
      * <file_name> is the displayed file name inside the archive
      */
     static bool compress(const QString &file_name,
                          const QByteArray &file_data, const QString &zip_path);
 
+    /* Rewrites the <input_zip> into the <output_zip>, re-evaluating every file on the <threads> (the ideal number if <= 0):
+     * recompresses at the <policy> level if it is smaller, converts the incompressible files to stored,
+     * and copies the already optimal ones as is, without recompression. The order and dates of the entries are kept,
+     * their external attributes and extra fields are not. Files failing the CRC-32 check stop the rewriting.
+     * Returns the counts, the bytes saved and the time spent; see OptimizeReport.
+     */
+    static OptimizeReport optimize(const QString &input_zip, const QString &output_zip,
+                                   const OptimizePolicy &policy = OptimizePolicy(), int threads = 0);
+
+    /* Removes the <entry_name> from the <zip_path> archive by rewriting only its central directory:
+     * the file data is left in place as a hole until <compact>. A folder entry is removed alone, without its contents.
+     * The archives larger than 4 GB (zip64) are not supported.
+     * The central directory is overwritten in place: if interrupted (crash, power loss, full disk),
+     * the archive is left unreadable; copy it beforehand if that can't be afforded.
+     */
+    static bool removeEntry(const QString &zip_path, const QString &entry_name);
+
+    /* Renames the <entry_name> to the <new_name> the same way, see <removeEntry>.
+     * The local header keeps the old name until <compact>; the zip readers use the central directory.
+     */
+    static bool renameEntry(const QString &zip_path, const QString &entry_name, const QString &new_name);
+
+    // Returns the number of bytes in the <zip_path> archive not used by any entry (holes), -1 if failed
+    static qint64 wastedSpace(const QString &zip_path);
+
+    /* Rewrites the <zip_path> archive without holes if they take more than the <threshold> part of it.
+     * The entries data is copied as is, without recompression; the stored ones keep their alignment.
+     * Only the names, dates and data are rewritten; the external attributes (e.g. Unix permissions),
+     * the extra fields and the comments of the entries are not carried over.
+     * The copy gets the permissions of the archive and replaces it atomically (on POSIX systems), and is kept if it can't.
+     * Returns true if there is nothing to do.
+     */
+    static bool compact(const QString &zip_path, double threshold = 0.1);
+
+    /* Compares the <zip_a> and <zip_b> archives entry by entry: by name, size and CRC-32 from the central directories,
+     * without decompression. The names of the <zip_b> are looked up in its <ZipReader::names> store.
+     * If <verifyContent>, the files with the same size and CRC-32 are also compared by the data,
+     * decompressing both by chunks. The lists are in the order of the entries.
+     */
+    static ArchiveDiff diff(const QString &zip_a, const QString &zip_b, bool verifyContent = false);
+
     // Checks whether the <data> is an archive
     static bool isArchive(const QByteArray &data);
 
@@ -257,14 +1149,61 @@ public:
     static bool isZipFile(const QString &filePath);
 
 
+    /*** Statistics ***/
+    /* Counters of the work done by QMicroz in the calling thread.
+     * Collected per entry, so the overhead is a pair of clock reads per entry or I/O call.
+     */
+    struct QMICROZ_EXPORT Stats {
+        qint64 bytesIn = 0;   // consumed: source data when zipping, compressed data when extracting
+        qint64 bytesOut = 0;  // produced: compressed data when zipping, extracted data when extracting
+        qint64 entries = 0;   // number of entries added or extracted
+
+        // Wall time in nanoseconds
+        qint64 inflateNs = 0; // decompression, including the CRC check done by miniz itself
+        qint64 deflateNs = 0; // compression, including the CRC calculation done by miniz itself
+        qint64 crcNs = 0;     // CRC-32 calculated by QMicroz separately from the codec
+        qint64 digestNs = 0;  // digests of the manifest calculated on extraction
+        qint64 fileIoNs = 0;  // reading/writing the archive file and the files on disk
+        qint64 mkdirNs = 0;   // creating folders on extraction
+        qint64 indexNs = 0;   // reading the central directory and building the contents list
+
+        // Sum of all measured times
+        qint64 totalNs() const;
+
+        // Bytes produced per second of the measured time
+        double throughput() const;
+
+        Stats& operator+=(const Stats &other);
+    }; // struct Stats
+
+    // Returns a snapshot of the calling thread's counters
+    static Stats stats();
+
+    // Resets the calling thread's counters
+    static void resetStats();
+
+
+    /*** Tracing ***/
+    /* Starts recording the spans of archive operations (open, index, inflate/deflate, mkdir...)
+     * made by all threads. Returns false if the library is built without the TRACE_EVENTS option.
+     */
+    static bool startTrace();
+
+    /* Stops recording and saves the spans to <jsonPath> in the Chrome Trace Event format,
+     * which can be opened with chrome://tracing or ui.perfetto.dev
+     */
+    static bool stopTrace(const QString &jsonPath);
+
+
     /*** Operators ***/
     // Checks whether the archive is set
-    explicit operator bool() const { return (bool)m_archive; }
+    explicit operator bool() const { return m_reader || m_writer; }
 
     /* Adds an item to the archive. */
     bool operator<<(const QString &sourcePath) { return addToZip(sourcePath); }
     bool operator<<(const BufFile &bufFile) { return addToZip(bufFile); }
     bool operator<<(const BufList &bufList) { return addToZip(bufList); }
+    bool operator<<(const BufFileList &bufFiles) { return addToZip(bufFiles); }
 
 
     /*** OBSOLETE ***/
@@ -290,42 +1229,20 @@ public:
     /*** OBSOLETE ***/
 
 private:
-    /* If the <entryName> is not in the <m_zip_entries> list:
-     * 1. adds item to the archive using the <addFunc>.
-     * 2. adds the <entryName> to the <m_zip_entries>.
-     */
-    bool addEntry(const QString &entryName, std::function<bool()> addFunc);
-
-    // Concatenates path strings, ensuring the separator is not duplicated
-    static QString joinPath(const QString &abs_path, const QString &rel_path);
+    // The opened archive: either the reader or the writer
+    const ZipArchive& archive() const;
 
-    // Checks whether the <name> is a folder entry name (ends with '/')
-    static inline bool isFolderName(const QString &name) { return name.endsWith(s_sep); }
+    // Reading core
+    ZipReader m_reader;
 
-    // Checks whether the <name> is a file entry name
-    static inline bool isFileName(const QString &name) { return !name.isEmpty() && !name.endsWith(s_sep); }
-
-    // Appends '/' if not any
-    static inline QString toFolderName(const QString &name) { return name.endsWith(s_sep) ? name : name + s_sep; }
-
-    // The void pointer is used to allow the miniz header not to be included
-    void *m_archive = nullptr;
-
-    // Whether to display more info into the terminal
-    bool m_verbose = false;
-
-    // Path to the current zip file
-    QString m_zip_path;
+    // Writing core
+    ZipWriter m_writer;
 
     // Folder to place the extracted files
     QString m_output_folder;
 
-    // Holds a list of the current archive contents { "entry name/path" : index }
-    ZipContents m_zip_entries;
-
     // Literal ".zip"
     static const QString s_zip_ext;
-    static constexpr QChar s_sep = u'/';
 
 }; // class QMicroz
 
@@ -8,6 +8,9 @@
 
 #include <QtTest/QTest>
 #include <qtestcase.h>
+#include <QCryptographicHash>
+#include <QtEndian>
+#include <thread>
 
 #include "qmicroz.h"
 
@@ -37,6 +40,34 @@ private slots:
     void test_nestedFoldersCreation();
     void test_extractFolder();
     void test_noArchiveSet();
+    void test_stats();
+    void test_trace();
+    void test_zipReaderWriter();
+    void test_entryInfo();
+    void test_zipNames();
+    void test_forEachEntry();
+    void test_extractToBufBounded();
+    void test_compress_bufFileList();
+    void test_enqueue();
+    void test_concurrentAdd();
+    void test_addCompressed();
+    void test_extractRaw();
+    void test_extractToFd();
+    void test_extractLarge();
+    void test_alignedStored();
+    void test_openNested();
+    void test_writeBuffer();
+    void test_compressToBuf();
+    void test_optimize();
+    void test_removeRenameCompact();
+    void test_updateAll();
+    void test_search();
+    void test_diff();
+    void test_extractManifest();
+    void test_compressorProfile();
+    void test_storedCrc();
+    void test_compactAligned();
+    void test_queueStopWhileBlocked();
     //void test_path_traversal();
 
 private:
@@ -460,6 +491,1015 @@ void test_qmicroz::test_noArchiveSet()
     */
 }
 
+void test_qmicroz::test_stats()
+{
+    QMicroz::resetStats();
+    QVERIFY(QMicroz::stats().entries == 0);
+
+    QString zip_file = tmp_test_dir + "/test_stats.zip";
+    QByteArray data = QByteArray("Some data to count. ").repeated(100);
+
+    QVERIFY(QMicroz::compress(BufFile("stats.txt", data), zip_file));
+
+    QMicroz::Stats st = QMicroz::stats();
+    QVERIFY(st.entries == 1);
+    QVERIFY(st.bytesIn == data.size());
+    QVERIFY(st.bytesOut > 0 && st.bytesOut < data.size());
+    QVERIFY(st.deflateNs > 0);
+
+    QMicroz::resetStats();
+    QVERIFY(QMicroz::extract(zip_file, tmp_test_dir + "/stats_out"));
+
+    st = QMicroz::stats();
+    QVERIFY(st.entries == 1);
+    QVERIFY(st.bytesOut == data.size());
+    QVERIFY(st.inflateNs > 0 && st.fileIoNs > 0 && st.indexNs > 0);
+    QVERIFY(st.totalNs() >= st.inflateNs + st.fileIoNs);
+
+    // the CRC-32 of the files on disk, calculated by QMicroz itself
+    QMicroz::resetStats();
+    QVERIFY(ZipReader(zip_file).updateAll(tmp_test_dir + "/stats_out", true));
+    st = QMicroz::stats();
+    QVERIFY(st.crcNs > 0);
+    QVERIFY(st.totalNs() >= st.crcNs + st.fileIoNs);
+}
+
+void test_qmicroz::test_trace()
+{
+    // the test_qmicroz_traced target is built with the recording
+    if (!QMicroz::startTrace()) {
+#if defined(EXPECT_TRACE_EVENTS)
+        QFAIL("The trace recording is not built in");
+#else
+        QSKIP("Built without TRACE_EVENTS option");
+#endif
+    }
+
+    QString zip_file = tmp_test_dir + "/test_trace.zip";
+    QVERIFY(QMicroz::compress(BufFile("traced.txt", "Some data to trace"), zip_file));
+    QVERIFY(QMicroz::extract(zip_file, tmp_test_dir + "/trace_out"));
+
+    QString trace_file = tmp_test_dir + "/test_trace.json";
+    QVERIFY(QMicroz::stopTrace(trace_file));
+    QVERIFY(!QMicroz::stopTrace(trace_file)); // already stopped
+
+    QFile file(trace_file);
+    QVERIFY(file.open(QFile::ReadOnly));
+    const QByteArray json = file.readAll();
+    QVERIFY(json.contains("traceEvents"));
+    QVERIFY(json.contains("deflate") && json.contains("inflate") && json.contains("traced.txt"));
+}
+
+void test_qmicroz::test_zipReaderWriter()
+{
+    QString zip_file = tmp_test_dir + "/test_zipReaderWriter.zip";
+    QByteArray data = QByteArray("Data for the lightweight classes. ").repeated(10);
+
+    ZipWriter writer(zip_file);
+    QVERIFY(writer && writer.addToZip(BufFile("folder/")));
+    QVERIFY(writer.addToZip(BufFile("folder/file.txt", data)));
+    QVERIFY(writer.contents().contains("folder/"));
+
+    ZipWriter moved_writer(std::move(writer));
+    QVERIFY(!writer && moved_writer);
+    QVERIFY(moved_writer.close() && !moved_writer);
+
+    ZipReader reader(zip_file);
+    QVERIFY(reader && reader.count() == 2);
+    QVERIFY(reader.isFolder(reader.findIndex("folder/")));
+
+    ZipReader moved_reader;
+    moved_reader = std::move(reader);
+    QVERIFY(!reader && moved_reader);
+    QCOMPARE(moved_reader.extractData(moved_reader.findIndex("folder/file.txt")), data);
+
+    // the buffer is shared with the reader
+    QFile file(zip_file);
+    QVERIFY(file.open(QFile::ReadOnly));
+    ZipReader buf_reader(file.readAll());
+    QVERIFY(buf_reader && buf_reader.zipFilePath().isEmpty());
+    QCOMPARE(buf_reader.extractToBuf().value("folder/file.txt"), data);
+}
+
+void test_qmicroz::test_entryInfo()
+{
+    QString zip_file = tmp_test_dir + "/test_entryInfo.zip";
+    QByteArray data = QByteArray("Entry info data. ").repeated(20);
+    QDateTime dt = QDateTime::fromString("2001-02-03 04:05", "yyyy-MM-dd HH:mm");
+
+    BufFile buf_file("folder/file.txt", data);
+    buf_file.modified = dt;
+
+    QMicroz qmz(zip_file, QMicroz::ModeWrite);
+    QVERIFY(qmz << BufFile("folder/") && qmz << buf_file);
+    qmz.closeArchive();
+
+    QVERIFY(qmz.setZipFile(zip_file));
+    const int index = qmz.findIndex("folder/file.txt");
+    const EntryInfo info = qmz.entryInfo(index);
+    QVERIFY(info && info.isFile());
+    QCOMPARE(info.name(), qmz.name(index));
+    QVERIFY(info.sizeCompressed == qmz.sizeCompressed(index));
+    QVERIFY(info.sizeUncompressed == data.size());
+    QCOMPARE(info.lastModified(), dt);
+    QVERIFY(!qmz.entryInfo(qmz.count()));
+
+    QStringList names;
+    for (const EntryInfo &entry : qmz.entries()) {
+        QVERIFY(entry.isFolder == qmz.isFolder(entry.index));
+        names << entry.name();
+    }
+
+    QCOMPARE(names, QStringList({ "folder/", "folder/file.txt" }));
+}
+
+void test_qmicroz::test_zipNames()
+{
+    ZipNames names;
+    names.append("folder/");
+    names.append("folder/sub/");
+    names.append("folder/sub/file.txt");
+    names.append("file.txt");
+
+    QVERIFY(names.size() == 4);
+    QVERIFY(names.indexOf(QString("folder/sub/file.txt")) == 2);
+    QVERIFY(names.indexOf(QString("folder/sub/")) == 1);
+    QVERIFY(names.indexOf(QString("folder/file.txt")) == -1);
+    QCOMPARE(names.folderView(2), QByteArray("folder/sub/"));
+    QCOMPARE(names.fileNameView(2), QByteArray("file.txt"));
+    QCOMPARE(names.folderView(3), QByteArray());
+    QCOMPARE(names.name(1), QString("folder/sub/"));
+
+    // the reader builds the store on request
+    QString zip_file = tmp_test_dir + "/test_zipNames.zip";
+    BufList buf_list;
+    for (int i = 0; i < 100; ++i)
+        buf_list.insert(QString("folder/sub_%1/file.txt").arg(i % 10) + QString::number(i), "data");
+
+    QVERIFY(QMicroz::compress(buf_list, zip_file));
+
+    ZipReader reader(zip_file);
+    QVERIFY(reader.names().size() == reader.count());
+    QCOMPARE(reader.names().name(reader.findIndex("folder/sub_3/file.txt93")), QString("folder/sub_3/file.txt93"));
+    QVERIFY(reader.findIndex("file.txt42") >= 0);
+
+    // the deep search returns the first match in the order of the paths, not of the entries
+    QString zip_file_2 = tmp_test_dir + "/test_zipNames_order.zip";
+    const BufFileList buf_files { BufFile("b/same.txt", "b"), BufFile("a/same.txt", "a") };
+    QVERIFY(QMicroz::compress(buf_files, zip_file_2));
+
+    ZipReader reader_2(zip_file_2);
+    QVERIFY(reader_2.findIndex("same.txt") == 1);
+}
+
+void test_qmicroz::test_forEachEntry()
+{
+    QString zip_file = tmp_test_dir + "/test_forEachEntry.zip";
+    BufList buf_list;
+    buf_list["folder/"] = QByteArray();
+    buf_list["folder/big.txt"] = QByteArray("Large file data. ").repeated(1000);
+    buf_list["folder/small.txt"] = "small";
+    buf_list["skip.bin"] = "not visited";
+
+    QVERIFY(QMicroz::compress(buf_list, zip_file));
+
+    QMicroz qmz(zip_file);
+    BufList visited;
+    auto filter = [](const EntryInfo &entry) { return !entry.rawName.endsWith(".bin"); };
+    auto visitor = [&visited](const EntryInfo &entry, const QByteArray &data) {
+        visited[entry.name()] = QByteArray(data.constData(), data.size());
+        return true;
+    };
+
+    QVERIFY(qmz.forEachEntry(filter, visitor));
+    QVERIFY(visited.size() == 3);
+    QCOMPARE(visited.value("folder/big.txt"), buf_list.value("folder/big.txt"));
+    QCOMPARE(visited.value("folder/small.txt"), buf_list.value("folder/small.txt"));
+
+    // stop on the first file
+    int count = 0;
+    QVERIFY(!qmz.forEachEntry(EntryFilter(), [&count](const EntryInfo &, const QByteArray &) { return ++count > 1; }));
+    QVERIFY(count == 1);
+}
+
+void test_qmicroz::test_extractToBufBounded()
+{
+    QString zip_file = tmp_test_dir + "/test_extractToBufBounded.zip";
+    BufList buf_list;
+    buf_list["folder/"] = QByteArray();
+    buf_list["folder/1.txt"] = QByteArray("First file. ").repeated(100);  // 1200 bytes
+    buf_list["folder/2.txt"] = QByteArray("Second file. ").repeated(100); // 1300 bytes
+    buf_list["folder/3.txt"] = QByteArray("Third file. ").repeated(50);   // 600 bytes
+
+    QVERIFY(QMicroz::compress(buf_list, zip_file));
+
+    QMicroz qmz(zip_file);
+    BoundedBufList extracted = qmz.extractToBufBounded(2000, tmp_test_dir);
+
+    QVERIFY(extracted.list().size() == buf_list.size());
+    QVERIFY(extracted.memorySize() <= 2000);
+    QVERIFY(extracted.spilledSize() > 0);
+    QVERIFY(extracted.memorySize() + extracted.spilledSize() == 3100);
+    QCOMPARE(extracted.list(), buf_list);
+
+    // moved, the mapped data stays valid
+    BoundedBufList moved(std::move(extracted));
+    QCOMPARE(moved.value("folder/2.txt"), buf_list.value("folder/2.txt"));
+
+    // the later of the same name entries wins, the spilled earlier one or not
+    QString dup_file = tmp_test_dir + "/test_extractToBufBounded_dup.zip";
+    const BufFileList buf_files { BufFile("a.txt", QByteArray("Spilled. ").repeated(100)), BufFile("b.txt", "In RAM") };
+    QVERIFY(QMicroz::compress(buf_files, dup_file));
+
+    QFile file(dup_file);
+    QVERIFY(file.open(QFile::ReadWrite));
+    QByteArray dup = file.readAll();
+    const int name_pos = dup.indexOf("b.txt", dup.indexOf("PK\x01\x02")); // in the central directory
+    QVERIFY(name_pos > 0);
+    dup[name_pos] = 'a';
+    QVERIFY(file.seek(0) && file.write(dup) == dup.size());
+    file.close();
+
+    ZipReader dup_reader(dup_file);
+    const BoundedBufList dup_extracted = dup_reader.extractToBufBounded(100, tmp_test_dir);
+    QVERIFY(dup_extracted.list().size() == 1);
+    QCOMPARE(dup_extracted.value("a.txt"), QByteArray("In RAM"));
+    QVERIFY(dup_extracted.spilledSize() == 0);
+}
+
+void test_qmicroz::test_compress_bufFileList()
+{
+    QString zip_file = tmp_test_dir + "/test_compress_bufFileList.zip";
+    const QByteArray data = QByteArray("Data to be released. ").repeated(50);
+
+    // the insertion order is kept
+    BufFileList buf_files;
+    buf_files << BufFile("z_first.txt", data) << BufFile("a_second.txt", data);
+
+    QVERIFY(QMicroz::compress(std::move(buf_files), zip_file));
+    QVERIFY(buf_files.isEmpty());
+
+    QMicroz qmz(zip_file);
+    QCOMPARE(qmz.name(0), QString("z_first.txt"));
+    QCOMPARE(qmz.name(1), QString("a_second.txt"));
+    QCOMPARE(qmz.extractData(1), data);
+
+    // consuming the BufList
+    QString zip_file_2 = tmp_test_dir + "/test_compress_bufList_moved.zip";
+    BufList buf_list;
+    buf_list["file.txt"] = data;
+
+    QVERIFY(QMicroz::compress(std::move(buf_list), zip_file_2));
+    QVERIFY(buf_list.isEmpty());
+    QVERIFY(qmz.setZipFile(zip_file_2));
+    QCOMPARE(qmz.extractData(0), data);
+}
+
+void test_qmicroz::test_enqueue()
+{
+    QString zip_file = tmp_test_dir + "/test_enqueue.zip";
+    const QByteArray data = QByteArray("Data produced by several threads. ").repeated(200);
+
+    QMicroz qmz(zip_file, QMicroz::ModeWrite);
+    QVERIFY(!qmz.enqueue(BufFile("not_started.txt", data))); // the queue is not started
+    QVERIFY(qmz.startQueue(4, 2));
+
+    auto produce = [&qmz, &data](int thread) {
+        for (int i = 0; i < 25; ++i)
+            qmz.enqueue(BufFile(QString("thread_%1/file_%2.txt").arg(thread).arg(i), data));
+    };
+
+    std::thread producer_1(produce, 1);
+    std::thread producer_2(produce, 2);
+    producer_1.join();
+    producer_2.join();
+
+    QVERIFY(qmz.enqueue(BufFile("tiny.txt", "tiny"))); // stored, not compressed
+    QVERIFY(qmz.waitForQueue());
+    QVERIFY(qmz.count() == 51);
+    qmz.closeArchive();
+
+    QVERIFY(qmz.setZipFile(zip_file, QMicroz::ModeRead));
+    QVERIFY(qmz.count() == 51);
+    QCOMPARE(qmz.name(50), QString("tiny.txt")); // written in the order of enqueueing
+    QCOMPARE(qmz.extractFileToBuf("thread_2/file_24.txt").data, data);
+    QVERIFY(qmz.sizeCompressed(qmz.findIndex("thread_1/file_0.txt")) < data.size());
+}
+
+void test_qmicroz::test_concurrentAdd()
+{
+    QString zip_file = tmp_test_dir + "/test_concurrentAdd.zip";
+    QString source_file = tmp_test_dir + "/concurrent_source.txt";
+    const QByteArray data = QByteArray("Compressed on the calling thread. ").repeated(200);
+
+    QFile file(source_file);
+    QVERIFY(file.open(QFile::WriteOnly) && file.write(data) == data.size());
+    file.close();
+
+    QMicroz qmz(zip_file, QMicroz::ModeWrite);
+    qmz.setConcurrent(true);
+
+    auto add = [&qmz, &data, &source_file](int thread) {
+        for (int i = 0; i < 20; ++i) {
+            qmz.addToZip(BufFile(QString("buf_%1_%2.txt").arg(thread).arg(i), data));
+            qmz.addToZip(source_file, QString("file_%1_%2.txt").arg(thread).arg(i));
+        }
+    };
+
+    std::thread thread_1(add, 1);
+    std::thread thread_2(add, 2);
+    thread_1.join();
+    thread_2.join();
+
+    QVERIFY(!qmz.addToZip(BufFile("buf_1_0.txt", data))); // already exists
+    QVERIFY(qmz.count() == 80);
+    qmz.closeArchive();
+
+    QVERIFY(qmz.setZipFile(zip_file, QMicroz::ModeRead));
+    QVERIFY(qmz.count() == 80);
+    QCOMPARE(qmz.extractFileToBuf("buf_2_19.txt").data, data);
+    QCOMPARE(qmz.extractFileToBuf("file_1_7.txt").data, data);
+    QVERIFY(qmz.sizeCompressed(qmz.findIndex("file_2_0.txt")) < data.size());
+}
+
+void test_qmicroz::test_addCompressed()
+{
+    QString zip_file = tmp_test_dir + "/test_addCompressed.zip";
+    const QByteArray data = QByteArray("Gzip member data. ").repeated(20);
+
+    // gzip.compress(data, mtime=946684800)
+    const QByteArray gzip = QByteArray::fromHex("1f8b080080436d3802ff73afca2c50c84dcd4d4a2d5248492c49d453701f15a1810800c797e39e68010000");
+    const QByteArray raw_deflate = gzip.mid(10, gzip.size() - 18);
+
+    QMicroz qmz(zip_file, QMicroz::ModeWrite);
+    QVERIFY(qmz.addCompressed("raw.txt", raw_deflate, data.size(), 0x9ee397c7));
+    QVERIFY(qmz.addGzip("gzip.txt", gzip));
+    QVERIFY(!qmz.addGzip("not_gzip.txt", data));
+    QVERIFY(!qmz.addCompressed("no_data.txt", QByteArray(), data.size(), 0x9ee397c7));
+    QVERIFY(qmz.addCompressed("empty.txt", QByteArray::fromHex("0300"), 0, 0)); // stored
+    qmz.closeArchive();
+
+    QVERIFY(qmz.setZipFile(zip_file, QMicroz::ModeRead));
+    QVERIFY(qmz.count() == 3);
+    QCOMPARE(qmz.extractData(0), data);
+    QCOMPARE(qmz.extractData(1), data);
+    QVERIFY(qmz.sizeCompressed(1) == raw_deflate.size());
+    QCOMPARE(qmz.lastModified(1), QDateTime::fromSecsSinceEpoch(946684800));
+    QVERIFY(qmz.extractData(2).isEmpty());
+    QVERIFY(qmz.sizeCompressed(2) == 0);
+}
+
+void test_qmicroz::test_extractRaw()
+{
+    QString zip_file = tmp_test_dir + "/test_extractRaw.zip";
+    BufList buf_list;
+    buf_list["deflated.txt"] = QByteArray("Served as gzip without inflating. ").repeated(100);
+    buf_list["stored.txt"] = "tiny"; // micro files are stored
+    QVERIFY(QMicroz::compress(buf_list, zip_file));
+
+    QMicroz qmz(zip_file);
+    const RawEntry deflated = qmz.extractRaw(qmz.findIndex("deflated.txt"));
+    const RawEntry stored = qmz.extractRaw(qmz.findIndex("stored.txt"));
+
+    QVERIFY(deflated && deflated.method == RawEntry::Deflated);
+    QVERIFY(deflated.data.size() == qmz.sizeCompressed(qmz.findIndex("deflated.txt")));
+    QVERIFY(deflated.sizeUncompressed == buf_list.value("deflated.txt").size());
+    QVERIFY(stored && stored.method == RawEntry::Stored);
+    QCOMPARE(stored.data, QByteArray("tiny"));
+
+    // the gzip members are read back without recompressing
+    QString zip_file_2 = tmp_test_dir + "/test_extractRaw_gzip.zip";
+    QMicroz qmz_2(zip_file_2, QMicroz::ModeWrite);
+    QVERIFY(qmz_2.addGzip("deflated.txt", deflated.toGzip()));
+    QVERIFY(qmz_2.addGzip("stored.txt", stored.toGzip()));
+    qmz_2.closeArchive();
+
+    QVERIFY(qmz_2.setZipFile(zip_file_2, QMicroz::ModeRead));
+    QCOMPARE(qmz_2.extractToBuf(), buf_list);
+}
+
+void test_qmicroz::test_extractToFd()
+{
+    QString zip_file = tmp_test_dir + "/test_extractToFd.zip";
+    BufList buf_list;
+    buf_list["stored.txt"] = "Stored data, too small for the kernel copy"; // micro files are stored
+    buf_list["deflated.txt"] = QByteArray("Deflated data. ").repeated(100);
+    QVERIFY(QMicroz::compress(buf_list, zip_file));
+
+    QMicroz qmz(zip_file);
+    const int stored = qmz.findIndex("stored.txt");
+    QVERIFY(qmz.extractRaw(stored).method == RawEntry::Stored);
+
+    // extracting to disk
+    QString stored_path = tmp_test_dir + "/extractToFd/stored.txt";
+    QVERIFY(qmz.extractIndex(stored, stored_path));
+    QFile stored_file(stored_path);
+    QVERIFY(stored_file.open(QFile::ReadOnly));
+    QCOMPARE(stored_file.readAll(), buf_list.value("stored.txt"));
+
+    // writing both to a file descriptor
+    QString fd_path = tmp_test_dir + "/extractToFd/fd.txt";
+    QFile fd_file(fd_path);
+    QVERIFY(fd_file.open(QFile::WriteOnly));
+    QVERIFY(qmz.extractToFd(stored, fd_file.handle()));
+    QVERIFY(qmz.extractToFd(qmz.findIndex("deflated.txt"), fd_file.handle()));
+    fd_file.close();
+
+    QVERIFY(fd_file.open(QFile::ReadOnly));
+    QCOMPARE(fd_file.readAll(), buf_list.value("stored.txt") + buf_list.value("deflated.txt"));
+}
+
+void test_qmicroz::test_extractLarge()
+{
+    QString zip_file = tmp_test_dir + "/test_extractLarge.zip";
+    BufFile buf_file("large.txt", QByteArray("Large compressible data. 1234567890\n").repeated(100000)); // > 1 MiB
+    QVERIFY(QMicroz::compress(buf_file, zip_file));
+
+    // inflated into the mapped file
+    QMicroz qmz(zip_file);
+    QString out_path = tmp_test_dir + "/extractLarge/large.txt";
+    QVERIFY(qmz.extractIndex(0, out_path));
+
+    QFile out_file(out_path);
+    QVERIFY(out_file.open(QFile::ReadOnly));
+    QVERIFY(out_file.size() == buf_file.data.size());
+    QCOMPARE(out_file.readAll(), buf_file.data);
+
+    // overwriting the existing larger file
+    out_file.close();
+    QVERIFY(out_file.open(QFile::WriteOnly | QFile::Append));
+    out_file.write("tail");
+    out_file.close();
+    QVERIFY(qmz.extractIndex(0, out_path));
+    QVERIFY(out_file.open(QFile::ReadOnly));
+    QCOMPARE(out_file.readAll(), buf_file.data);
+    out_file.close();
+
+    // the forged size, beyond what the compressed data can give, is not preallocated
+    QFile file(zip_file);
+    QVERIFY(file.open(QFile::ReadOnly));
+    QByteArray forged = file.readAll();
+    const int central = forged.indexOf("PK\x01\x02");
+    QVERIFY(central > 0);
+    qToLittleEndian<quint32>(0x7fffffff, forged.data() + central + 24); // uncompressed size
+
+    QString forged_file = tmp_test_dir + "/test_extractLarge_forged.zip";
+    QFile forged_zip(forged_file);
+    QVERIFY(forged_zip.open(QFile::WriteOnly) && forged_zip.write(forged) == forged.size());
+    forged_zip.close();
+
+    ZipReader forged_reader(forged_file);
+    QVERIFY(!forged_reader.extractIndex(0, out_path));
+    QVERIFY(QFileInfo(out_path).size() < 0x7fffffff);
+}
+
+void test_qmicroz::test_alignedStored()
+{
+    QString zip_file = tmp_test_dir + "/test_alignedStored.zip";
+    const QByteArray asset = QByteArray("Asset data to be mapped. ").repeated(300);
+
+    QString source_file = tmp_test_dir + "/alignedStored_source.bin";
+    QFile source(source_file);
+    QVERIFY(source.open(QFile::WriteOnly));
+    source.write(asset);
+    source.close();
+
+    QMicroz qmz(zip_file, QMicroz::ModeWrite);
+    QVERIFY(!qmz.setAlignment(1000));
+    QVERIFY(qmz.setAlignment(4096));
+    QVERIFY(qmz.addToZip(BufFile("deflated.txt", asset)));
+    QVERIFY(qmz.addStored(BufFile("assets/stored.bin", asset)));
+    QVERIFY(qmz.addStored(source_file, "assets/from_file.bin"));
+    QVERIFY(qmz.setAlignment(65536));
+    QVERIFY(qmz.addStored(BufFile("assets/stored_64k.bin", asset)));
+    qmz.closeArchive();
+
+    QVERIFY(qmz.setZipFile(zip_file, QMicroz::ModeRead));
+    QVERIFY(qmz.count() == 4);
+    QVERIFY(qmz.mapStored(0).isNull()); // compressed
+    QCOMPARE(qmz.extractData(0), asset);
+
+    for (int i = 1; i < qmz.count(); ++i) {
+        const int alignment = (i == 3) ? 65536 : 4096;
+        QVERIFY(qmz.sizeCompressed(i) == asset.size());
+        QVERIFY(qmz.dataOffset(i) % alignment == 0);
+
+        // the zip file mapping keeps the alignment
+        const QByteArray view = qmz.mapStored(i);
+        QCOMPARE(view, asset);
+        QVERIFY(quintptr(view.constData()) % 4096 == 0);
+        QCOMPARE(qmz.extractData(i), asset);
+    }
+
+    // buffered archive
+    QFile file(zip_file);
+    QVERIFY(file.open(QFile::ReadOnly));
+    ZipReader reader(file.readAll());
+    QCOMPARE(reader.mapStored(1), asset);
+}
+
+void test_qmicroz::test_openNested()
+{
+    QString inner_file = tmp_test_dir + "/test_openNested_inner.zip";
+    QString zip_file = tmp_test_dir + "/test_openNested.zip";
+
+    BufList inner_list;
+    inner_list["chapter1.xhtml"] = QByteArray("<p>Chapter 1</p>\n").repeated(50);
+    inner_list["mimetype"] = "application/epub+zip";
+    QVERIFY(QMicroz::compress(inner_list, inner_file));
+
+    QFile inner(inner_file);
+    QVERIFY(inner.open(QFile::ReadOnly));
+    const QByteArray inner_data = inner.readAll();
+
+    QMicroz qmz(zip_file, QMicroz::ModeWrite);
+    QVERIFY(qmz.addStored(BufFile("books/stored.epub", inner_data)));
+    QVERIFY(qmz.addToZip(BufFile("books/deflated.epub", inner_data)));
+    QVERIFY(qmz.addToZip(BufFile("not_zip.txt", "Just a text file, not an archive.")));
+    qmz.closeArchive();
+
+    QVERIFY(qmz.setZipFile(zip_file, QMicroz::ModeRead));
+    QVERIFY(!qmz.openNested(qmz.findIndex("not_zip.txt")));
+
+    // read in place from the zip file, and inflated
+    for (const QString &name : { QString("books/stored.epub"), QString("books/deflated.epub") }) {
+        std::unique_ptr<QMicroz> nested = qmz.openNested(qmz.findIndex(name));
+        QVERIFY(nested && nested->isModeReading());
+        QCOMPARE(nested->extractToBuf(), inner_list);
+        QCOMPARE(nested->extractData(nested->findIndex("mimetype")), inner_list.value("mimetype"));
+    }
+
+    // read in place from the buffer; outlives the outer archive
+    QFile file(zip_file);
+    QVERIFY(file.open(QFile::ReadOnly));
+    QVERIFY(qmz.setZipBuffer(file.readAll()));
+    std::unique_ptr<QMicroz> nested = qmz.openNested(qmz.findIndex("books/stored.epub"));
+    qmz.closeArchive();
+
+    QVERIFY(nested);
+    QCOMPARE(nested->extractToBuf(), inner_list);
+    QCOMPARE(nested->mapStored(nested->findIndex("mimetype")), inner_list.value("mimetype"));
+
+    // the forged extra field length of the first local header points past the end of the buffer
+    QVERIFY(file.seek(0));
+    QByteArray forged = file.readAll();
+    QVERIFY(forged.startsWith("PK\x03\x04"));
+    forged[28] = char(0xff);
+    forged[29] = char(0xff);
+
+    ZipReader forged_reader;
+    QVERIFY(forged_reader.openBuffer(forged));
+    QCOMPARE(forged_reader.name(0), QString("books/stored.epub"));
+    QVERIFY(!forged_reader.openNested(0));
+}
+
+void test_qmicroz::test_writeBuffer()
+{
+    BufList buf_list;
+    buf_list["file1.txt"] = QByteArray("Data of the file 1. ").repeated(100);
+    buf_list["folder/file2.txt"] = "Tiny";
+
+    // a new archive in memory
+    QMicroz qmz;
+    QVERIFY(qmz.setZipBuffer(QByteArray(), QMicroz::ModeWrite));
+    QVERIFY(qmz.isModeWriting());
+    QVERIFY(qmz.addToZip(buf_list));
+    const QByteArray zip = qmz.takeBuffer();
+
+    QVERIFY(QMicroz::isArchive(zip));
+    QVERIFY(!qmz.isModeWriting());
+    QCOMPARE(ZipReader(zip).extractToBuf(), buf_list);
+
+    // editing: the source buffer is kept as is
+    const QByteArray zip_copy(zip.constData(), zip.size());
+    QVERIFY(qmz.setZipBuffer(zip, QMicroz::ModeWrite));
+    QVERIFY(!qmz.addToZip(BufFile("file1.txt", "Duplicate")));
+    QVERIFY(qmz.addToZip(BufFile("added.txt", "Added to the existing archive")));
+    const QByteArray edited = qmz.takeBuffer();
+
+    QCOMPARE(zip, zip_copy);
+    buf_list["added.txt"] = "Added to the existing archive";
+    QCOMPARE(ZipReader(edited).extractToBuf(), buf_list);
+}
+
+void test_qmicroz::test_compressToBuf()
+{
+    BufList buf_list;
+    buf_list["response.json"] = QByteArray("{\"key\": \"value\"}, ").repeated(200);
+    buf_list["tiny.txt"] = "Stored";
+    buf_list["folder/"] = QByteArray();
+
+    const QByteArray zip = QMicroz::compressToBuf(buf_list);
+    QVERIFY(QMicroz::isArchive(zip));
+
+    QVERIFY(zip.size() < buf_list.value("response.json").size());
+
+    ZipReader reader(zip);
+    QVERIFY(reader.count() == 3);
+    QCOMPARE(reader.extractData(reader.findIndex("response.json")), buf_list.value("response.json"));
+    QCOMPARE(reader.extractData(reader.findIndex("tiny.txt")), buf_list.value("tiny.txt"));
+
+    BufFileList buf_files { BufFile("b.txt", "Second"), BufFile("a.txt", "First") };
+    ZipReader ordered(QMicroz::compressToBuf(buf_files));
+    QCOMPARE(ordered.name(0), QString("b.txt"));
+    QCOMPARE(ordered.extractData(1), QByteArray("First"));
+
+    QVERIFY(QMicroz::compressToBuf(BufList()).isEmpty());
+}
+
+void test_qmicroz::test_optimize()
+{
+    QString input_zip = tmp_test_dir + "/test_optimize_in.zip";
+    QString output_zip = tmp_test_dir + "/test_optimize_out.zip";
+
+    // incompressible data, like a JPEG
+    QByteArray noise(20000, Qt::Uninitialized);
+    quint32 seed = 12345;
+    for (char &ch : noise) {
+        seed = seed * 1103515245 + 12345;
+        ch = char(seed >> 24);
+    }
+
+    BufFileList buf_files {
+        BufFile("photos/"),
+        BufFile("photos/noise.jpg", noise),
+        BufFile("text.txt", QByteArray("Text to recompress at a higher level. 1234567890\n").repeated(300)),
+        BufFile("tiny.txt", "Stored")
+    };
+    QVERIFY(QMicroz::compress(buf_files, input_zip));
+
+    OptimizePolicy policy;
+    policy.level = 0;
+    QVERIFY(!QMicroz::optimize(input_zip, output_zip, policy, 2));
+
+    policy.level = 10;
+    QMicroz::resetStats();
+    const OptimizeReport report = QMicroz::optimize(input_zip, output_zip, policy, 2);
+
+    QVERIFY(report);
+    QVERIFY(QMicroz::stats().deflateNs > 0); // counted on the worker threads
+    QVERIFY(report.stored == 1); // noise.jpg
+    QVERIFY(report.recompressed + report.copied == 3);
+    QVERIFY(report.saved() > 0);
+    QVERIFY(report.sizeAfter == QFileInfo(output_zip).size());
+
+    ZipReader reader(output_zip);
+    QVERIFY(reader.count() == buf_files.size());
+    QVERIFY(reader.extractRaw(1).method == RawEntry::Stored);
+
+    for (int i = 0; i < buf_files.size(); ++i) {
+        QCOMPARE(reader.name(i), buf_files.at(i).name);
+        QCOMPARE(reader.extractData(i), buf_files.at(i).data);
+    }
+
+    // the same output, with the compressor states freed after each file
+    QString output_zip_2 = tmp_test_dir + "/test_optimize_out_2.zip";
+    policy.compressorProfile = CompressorProfile::LowMemory;
+    const OptimizeReport report_2 = QMicroz::optimize(input_zip, output_zip_2, policy, 2);
+    QVERIFY(report_2 && report_2.sizeAfter == report.sizeAfter);
+}
+
+void test_qmicroz::test_removeRenameCompact()
+{
+    QString zip_file = tmp_test_dir + "/test_removeRenameCompact.zip";
+
+    BufFileList buf_files {
+        BufFile("remove.txt", QByteArray("Data to remove. ").repeated(100)),
+        BufFile("folder/"),
+        BufFile("folder/rename.txt", QByteArray("Data to rename. ").repeated(100)),
+        BufFile("keep.txt", "Kept as is")
+    };
+    QVERIFY(QMicroz::compress(buf_files, zip_file));
+    QVERIFY(QMicroz::wastedSpace(zip_file) == 0);
+
+    QVERIFY(QMicroz::removeEntry(zip_file, "remove.txt"));
+    QVERIFY(!QMicroz::removeEntry(zip_file, "remove.txt"));
+    QVERIFY(QMicroz::renameEntry(zip_file, "folder/rename.txt", "folder/renamed_файл.txt"));
+    QVERIFY(!QMicroz::renameEntry(zip_file, "keep.txt", "folder/renamed_файл.txt")); // taken
+    QVERIFY(QMicroz::wastedSpace(zip_file) > 0);
+
+    auto verify = [&]() {
+        ZipReader reader(zip_file);
+        QVERIFY(reader.count() == 3);
+        QCOMPARE(reader.name(0), QString("folder/"));
+        QCOMPARE(reader.extractData(reader.findIndex("folder/renamed_файл.txt")), buf_files.at(2).data);
+        QCOMPARE(reader.extractData(reader.findIndex("keep.txt")), buf_files.at(3).data);
+        QVERIFY(reader.findIndex("remove.txt") < 0);
+    };
+
+    verify();
+
+    // below the threshold: nothing to do
+    const qint64 size = QFileInfo(zip_file).size();
+    QVERIFY(QMicroz::compact(zip_file, 0.9));
+    QVERIFY(QFileInfo(zip_file).size() == size);
+
+    QVERIFY(QMicroz::compact(zip_file, 0.0));
+    QVERIFY(QMicroz::wastedSpace(zip_file) == 0);
+    QVERIFY(QFileInfo(zip_file).size() < size);
+    verify();
+}
+
+void test_qmicroz::test_updateAll()
+{
+    QString zip_file = tmp_test_dir + "/test_updateAll.zip";
+    QString output_folder = tmp_test_dir + "/updateAll";
+
+    BufFileList buf_files {
+        BufFile("app/config.ini", "key=value"),
+        BufFile("app/data.bin", QByteArray("Deployed data. ").repeated(100)),
+        BufFile("readme.txt", "Readme")
+    };
+    for (BufFile &buf_file : buf_files) {
+        buf_file.modified = QDateTime::fromSecsSinceEpoch(1600000000);
+    }
+    QVERIFY(QMicroz::compress(buf_files, zip_file));
+
+    ZipReader reader(zip_file);
+    QVERIFY(reader.updateAll(output_folder));
+
+    auto readFile = [&](const QString &name) {
+        QFile file(output_folder + '/' + name);
+        return file.open(QFile::ReadOnly) ? file.readAll() : QByteArray();
+    }; // lambda readFile
+
+    // the same size and date: skipped unless the CRC is verified
+    QFile changed(output_folder + "/app/config.ini");
+    QVERIFY(changed.open(QFile::ReadWrite));
+    changed.write("key=VALUE");
+    changed.setFileTime(QDateTime::fromSecsSinceEpoch(1600000000), QFileDevice::FileModificationTime);
+    changed.close();
+    QVERIFY(QFile::remove(output_folder + "/readme.txt"));
+
+    QVERIFY(reader.updateAll(output_folder));
+    QCOMPARE(readFile("app/config.ini"), QByteArray("key=VALUE"));
+    QCOMPARE(readFile("readme.txt"), buf_files.at(2).data);
+
+    QVERIFY(reader.updateAll(output_folder, true));
+    QCOMPARE(readFile("app/config.ini"), buf_files.at(0).data);
+    QCOMPARE(readFile("app/data.bin"), buf_files.at(1).data);
+}
+
+void test_qmicroz::test_search()
+{
+    QString zip_file = tmp_test_dir + "/test_search.zip";
+    QByteArray big = QByteArray("Large file data. ").repeated(10000);
+    big.replace(32760, 6, "NEEDLE"); // spans the 32 KB chunks of the inflated data
+
+    BufList buf_list;
+    buf_list["folder/"] = QByteArray();
+    buf_list["folder/big.txt"] = big;
+    buf_list["folder/small.txt"] = "a NEEDLE and another NEEDLE";
+    buf_list["skip.bin"] = "NEEDLE";
+
+    QVERIFY(QMicroz::compress(buf_list, zip_file));
+
+    QMicroz qmz(zip_file);
+    auto filter = [](const EntryInfo &entry) { return !entry.rawName.endsWith(".bin"); };
+    QMicroz::resetStats();
+    const QVector<SearchHit> hits = qmz.search("NEEDLE", filter, 2);
+
+    // the files searched by the other thread are counted too
+    QVERIFY(QMicroz::stats().entries == 2);
+    QVERIFY(QMicroz::stats().bytesOut == big.size() + buf_list.value("folder/small.txt").size());
+
+    QVERIFY(hits.size() == 3);
+    QCOMPARE(qmz.name(hits.at(0).index), QString("folder/big.txt"));
+    QVERIFY(hits.at(0).offset == 32760);
+    QVERIFY(hits.at(0).context.size() == 32 + 6 + 32);
+    QCOMPARE(hits.at(0).context.mid(hits.at(0).contextPos, 6), QByteArray("NEEDLE"));
+    QCOMPARE(hits.at(0).context, big.mid(32760 - 32, 70));
+
+    QCOMPARE(qmz.name(hits.at(1).index), QString("folder/small.txt"));
+    QVERIFY(hits.at(1).offset == 2);
+    QVERIFY(hits.at(1).contextPos == 2);
+    QVERIFY(hits.at(2).offset == 21);
+    QCOMPARE(hits.at(2).context, buf_list.value("folder/small.txt"));
+
+    // the first match in the order of the entries, even if the later small files are searched faster
+    const QVector<SearchHit> first = qmz.search("NEEDLE", EntryFilter(), 4, true);
+    QVERIFY(first.size() == 1);
+    QVERIFY(first.at(0).index == hits.at(0).index && first.at(0).offset == 32760);
+    QVERIFY(qmz.search("missing").isEmpty());
+}
+
+void test_qmicroz::test_diff()
+{
+    QString zip_a = tmp_test_dir + "/test_diff_a.zip";
+    QString zip_b = tmp_test_dir + "/test_diff_b.zip";
+
+    BufList buf_a;
+    buf_a["folder/"] = QByteArray();
+    buf_a["folder/same.txt"] = QByteArray("Same data. ").repeated(1000);
+    buf_a["folder/changed.txt"] = "old data";
+    buf_a["removed.txt"] = "removed";
+
+    BufList buf_b = buf_a;
+    buf_b.remove("removed.txt");
+    buf_b["folder/changed.txt"] = "new data";
+    buf_b["added.txt"] = "added";
+
+    QVERIFY(QMicroz::compress(buf_a, zip_a));
+    QVERIFY(QMicroz::compress(buf_b, zip_b));
+
+    ArchiveDiff diff = QMicroz::diff(zip_a, zip_b);
+    QVERIFY(diff);
+    QVERIFY(!diff.isIdentical());
+    QCOMPARE(diff.added, QStringList{ "added.txt" });
+    QCOMPARE(diff.removed, QStringList{ "removed.txt" });
+    QCOMPARE(diff.modified, QStringList{ "folder/changed.txt" });
+    QVERIFY(diff.unchanged == 2);
+
+    // the same files stored instead of deflated
+    QString zip_stored = tmp_test_dir + "/test_diff_stored.zip";
+    ZipWriter writer;
+    QVERIFY(writer.open(zip_stored));
+    for (auto it = buf_a.constBegin(); it != buf_a.constEnd(); ++it) {
+        QVERIFY(writer.addStored(BufFile(it.key(), it.value())));
+    }
+    QVERIFY(writer.close());
+
+    diff = QMicroz::diff(zip_a, zip_stored, true);
+    QVERIFY(diff.isIdentical());
+    QVERIFY(diff.unchanged == buf_a.size());
+
+    QVERIFY(!QMicroz::diff(zip_a, tmp_test_dir + "/missing.zip"));
+}
+
+void test_qmicroz::test_extractManifest()
+{
+    QString zip_file = tmp_test_dir + "/test_extractManifest.zip";
+    QString output_folder = tmp_test_dir + "/extractManifest";
+
+    BufList buf_list;
+    buf_list["folder/"] = QByteArray();
+    buf_list["folder/large.txt"] = QByteArray("Large file data. ").repeated(100000); // inflated into the mapping
+    buf_list["folder/small.txt"] = "small";
+    buf_list["root.txt"] = "root";
+
+    QVERIFY(QMicroz::compress(buf_list, zip_file));
+
+    const DigestList algorithms { QCryptographicHash::Sha256, QCryptographicHash::Md5 };
+    ZipReader reader(zip_file);
+    QMicroz::resetStats();
+    Manifest manifest = reader.extractAll(output_folder, algorithms, 2);
+
+    QVERIFY(manifest);
+    QVERIFY(manifest.files.size() == 3);
+    QVERIFY(QMicroz::stats().entries == 3); // counted by both threads
+
+    for (const ManifestEntry &file : manifest.files) {
+        const QByteArray &data = buf_list.value(file.name);
+        QVERIFY(file.size == data.size());
+        QVERIFY(file.digests.size() == 2);
+        QCOMPARE(file.digests.at(0), QCryptographicHash::hash(data, QCryptographicHash::Sha256));
+        QCOMPARE(file.digests.at(1), QCryptographicHash::hash(data, QCryptographicHash::Md5));
+
+        QFile extracted(output_folder + '/' + file.name);
+        QVERIFY(extracted.open(QFile::ReadOnly));
+        QCOMPARE(extracted.readAll(), data);
+    }
+
+    // only the folder contents
+    manifest = reader.extractFolder("folder", output_folder + "/copy", algorithms);
+    QVERIFY(manifest.files.size() == 2);
+    QCOMPARE(manifest.files.at(1).name, QString("folder/small.txt"));
+    QVERIFY(QFileInfo::exists(output_folder + "/copy/small.txt"));
+
+    // the same digests of the streamed files
+    manifest = reader.forEachEntry(EntryFilter(), [](const EntryInfo &, const QByteArray &) { return true; }, algorithms);
+    QVERIFY(manifest.files.size() == 3);
+    QCOMPARE(manifest.files.at(0).digests.at(0), QCryptographicHash::hash(buf_list.value(manifest.files.at(0).name),
+                                                                            QCryptographicHash::Sha256));
+}
+
+void test_qmicroz::test_compressorProfile()
+{
+    QString zip_file = tmp_test_dir + "/test_compressorProfile.zip";
+    QString source_file = tmp_test_dir + "/test_compressorProfile.txt";
+    QByteArray data = QByteArray("Low memory profile data. ").repeated(2000);
+
+    QFile file(source_file);
+    QVERIFY(file.open(QFile::WriteOnly));
+    file.write(data);
+    file.close();
+
+    QVERIFY(QMicroz::compressorMemory() > 0);
+
+    QMicroz qmz(zip_file, QMicroz::ModeWrite);
+    qmz.setConcurrent(true);
+    qmz.setCompressorProfile(CompressorProfile::LowMemory);
+
+    auto add = [&qmz, &data, &source_file](int thread) {
+        for (int i = 0; i < 10; ++i) {
+            qmz.addToZip(BufFile(QString("buf_%1_%2.txt").arg(thread).arg(i), data));
+            qmz.addToZip(source_file, QString("file_%1_%2.txt").arg(thread).arg(i));
+        }
+    };
+
+    std::thread thread_1(add, 1);
+    std::thread thread_2(add, 2);
+    thread_1.join();
+    thread_2.join();
+    qmz.closeArchive();
+
+    QVERIFY(qmz.setZipFile(zip_file, QMicroz::ModeRead));
+    QVERIFY(qmz.count() == 40);
+    QCOMPARE(qmz.extractFileToBuf("buf_1_9.txt").data, data);
+    QCOMPARE(qmz.extractFileToBuf("file_2_3.txt").data, data);
+    QVERIFY(qmz.sizeCompressed(qmz.findIndex("file_1_0.txt")) < data.size());
+}
+
+void test_qmicroz::test_storedCrc()
+{
+    QString zip_file = tmp_test_dir + "/test_storedCrc.zip";
+    const QByteArray data = QByteArray("Stored data. ").repeated(100000); // > 1 MiB, copied in the kernel
+
+    ZipWriter writer(zip_file);
+    QVERIFY(writer.addStored(BufFile("stored.txt", data)));
+    QVERIFY(writer.close());
+
+    qint64 offset = -1;
+    {
+        ZipReader reader(zip_file);
+        offset = reader.dataOffset(0);
+    }
+    QVERIFY(offset > 0);
+
+    // corrupts the data, not the headers
+    QFile file(zip_file);
+    QVERIFY(file.open(QFile::ReadWrite) && file.seek(offset + 10));
+    file.write("X");
+    file.close();
+
+    ZipReader reader(zip_file);
+    QVERIFY(!reader.extractIndex(0, tmp_test_dir + "/storedCrc/stored.txt"));
+
+    QFile out(tmp_test_dir + "/storedCrc/fd.txt");
+    QVERIFY(out.open(QFile::WriteOnly));
+    QVERIFY(!reader.extractToFd(0, out.handle()));
+
+    // the stored data is not copied into the optimized archive unchecked
+    QVERIFY(!QMicroz::optimize(zip_file, tmp_test_dir + "/test_storedCrc_optimized.zip"));
+}
+
+void test_qmicroz::test_compactAligned()
+{
+    QString zip_file = tmp_test_dir + "/test_compactAligned.zip";
+
+    ZipWriter writer(zip_file);
+    QVERIFY(writer.addToZip(BufFile("remove.txt", QByteArray("Data to remove. ").repeated(100))));
+    QVERIFY(writer.setAlignment(4096));
+    QVERIFY(writer.addStored(BufFile("aligned.bin", QByteArray(5000, 'a'))));
+    QVERIFY(writer.close());
+
+    // the compacted copy gets the permissions of the archive
+    const QFileDevice::Permissions permissions = QFileDevice::ReadOwner | QFileDevice::WriteOwner
+                                                 | QFileDevice::ReadGroup | QFileDevice::ReadOther;
+    QVERIFY(QFile(zip_file).setPermissions(permissions));
+    const QFileDevice::Permissions before = QFileInfo(zip_file).permissions(); // with the user flags
+    QVERIFY(before & QFileDevice::ReadOther);
+
+    QVERIFY(QMicroz::removeEntry(zip_file, "remove.txt"));
+    QVERIFY(QMicroz::compact(zip_file, 0.0));
+    QVERIFY(QFileInfo(zip_file).permissions() == before);
+
+    ZipReader reader(zip_file);
+    QVERIFY(reader.count() == 1);
+    QVERIFY(reader.dataAlignment(0) == 4096);
+    QVERIFY(reader.dataOffset(0) % 4096 == 0);
+    QCOMPARE(reader.extractData(0), QByteArray(5000, 'a'));
+
+    // no compacted copy is left over
+    QVERIFY(QDir(tmp_test_dir).entryList(QStringList{ "test_compactAligned.zip.*" }).isEmpty());
+}
+
+void test_qmicroz::test_queueStopWhileBlocked()
+{
+    QString zip_file = tmp_test_dir + "/test_queueStopWhileBlocked.zip";
+    const QByteArray data = QByteArray("Blocked producer data. ").repeated(20000);
+
+    ZipWriter writer(zip_file);
+    QVERIFY(writer.startQueue(1, 1));
+
+    // the producer blocks on the full queue while it is stopped
+    int enqueued = 0;
+    std::thread producer([&]() {
+        for (int i = 0; i < 50; ++i) {
+            if (writer.enqueue(BufFile(QString("file_%1.txt").arg(i), data)))
+                ++enqueued;
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    QVERIFY(writer.stopQueue());
+    producer.join();
+    QVERIFY(writer.close());
+
+    ZipReader reader(zip_file);
+    QVERIFY(reader.count() == enqueued);
+}
+
 /*void test_qmicroz::test_path_traversal()
 {
     QString zip_file = tmp_test_dir + "/test_path_traversal.zip";